@@ -0,0 +1,219 @@
+#!/usr/bin/env python
+"""Spawn throughput and latency benchmark.
+
+Build the extension in place first (python setup.py build_ext --inplace),
+then run e.g. ``python benchmark.py -n 2000``, optionally restricted to
+some cases: ``python benchmark.py baseline threads``.
+
+Latency percentiles cover only the spawn call. spawns/s is wall clock
+time including reaping each child, so it is comparable across threads.
+The calls case times the argument parsing alone, its spawns/s column
+is calls/s.
+"""
+
+import argparse
+import os
+import signal
+import subprocess
+import sys
+import threading
+import time
+
+import pdeathsignal
+
+
+TRUE = b'/bin/true'
+
+
+def reap(pid):
+    if isinstance(pid, tuple):
+        pid, pidfd = pid
+        os.close(pidfd)
+    try:
+        os.waitpid(pid, 0)
+    except ChildProcessError:
+        # sibling and doublefork children are not ours
+        pass
+
+
+def percentile(sorted_values, percent):
+    if not sorted_values:
+        return 0
+    index = min(len(sorted_values) - 1, (len(sorted_values) * percent + 99) // 100 - 1)
+    return sorted_values[max(0, index)]
+
+
+def measure(spawn, count):
+    samples = []
+    clock = time.perf_counter_ns
+    started = clock()
+    for _ in range(count):
+        before = clock()
+        result = spawn()
+        samples.append(clock() - before)
+        reap(result)
+    return samples, clock() - started
+
+
+def report(name, measured):
+    samples, elapsed_ns = measured
+    samples = sorted(samples)
+    rate = len(samples) * 1e9 / elapsed_ns if elapsed_ns else 0.0
+    print('%-36s %10.0f %9.1f %9.1f %9.1f %9.1f' % (
+        name, rate,
+        percentile(samples, 50) / 1e3,
+        percentile(samples, 90) / 1e3,
+        percentile(samples, 99) / 1e3,
+        samples[-1] / 1e3 if samples else 0.0,
+    ))
+    sys.stdout.flush()
+
+
+def case_baseline(count):
+    for backend in pdeathsignal.backends():
+        report('cloneandexecve backend=%s' % backend, measure(
+            lambda: pdeathsignal.cloneandexecve(TRUE, None, None, backend=backend), count,
+        ))
+    report('os.posix_spawn', measure(
+        lambda: os.posix_spawn(TRUE, [TRUE], os.environ), count,
+    ))
+    report('subprocess.Popen', measure(
+        lambda: subprocess.Popen([TRUE]).pid, count,
+    ))
+    spec = pdeathsignal.SpawnSpec(TRUE)
+    report('SpawnSpec.spawn', measure(spec.spawn, count))
+    pdeathsignal.use_helper_process()
+    try:
+        report('cloneandexecve use_helper_process', measure(
+            lambda: pdeathsignal.cloneandexecve(TRUE, None, None), count,
+        ))
+    finally:
+        pdeathsignal.use_helper_process(False)
+
+
+def case_flags(count):
+    large_sigign = [
+        signum for signum in range(1, signal.NSIG)
+        if signum not in (signal.SIGKILL, signal.SIGSTOP) and
+        not (32 <= signum < signal.SIGRTMIN)
+    ]
+    variants = [
+        ('sibling', dict(sibling=True)),
+        ('setsid', dict(setsid=True)),
+        ('doublefork', dict(doublefork=True)),
+        ('signal=SIGTERM', dict(signal=signal.SIGTERM)),
+        ('sigign (%d signals)' % len(large_sigign), dict(sigign=large_sigign)),
+        ('pidfd', dict(pidfd=True)),
+    ]
+    for name, kwargs in variants:
+        report('flags %s' % name, measure(
+            lambda: pdeathsignal.cloneandexecve(TRUE, None, None, **kwargs), count,
+        ))
+    report('flags search_path', measure(
+        lambda: pdeathsignal.cloneandexecve(b'true', None, None, search_path=True), count,
+    ))
+
+
+def case_env(count, variables=2000, size=128):
+    value = 'x' * size
+    environment = dict(os.environ)
+    environment.update(('BENCH_%d' % index, value) for index in range(variables))
+    as_list = [('%s=%s' % item).encode() for item in environment.items()]
+    as_tuple = tuple(as_list)
+
+    label = 'env %d vars' % len(as_list)
+    report('%s cloneandexecve list' % label, measure(
+        lambda: pdeathsignal.cloneandexecve(TRUE, None, as_list), count,
+    ))
+    report('%s cloneandexecve tuple' % label, measure(
+        lambda: pdeathsignal.cloneandexecve(TRUE, None, as_tuple), count,
+    ))
+    report('%s os.posix_spawn' % label, measure(
+        lambda: os.posix_spawn(TRUE, [TRUE], environment), count,
+    ))
+    report('%s subprocess.Popen' % label, measure(
+        lambda: subprocess.Popen([TRUE], env=environment).pid, count,
+    ))
+
+
+def case_threads(count, threads=(1, 2, 4, 8)):
+    for thread_count in threads:
+        per_thread = max(1, count // thread_count)
+        results = [None] * thread_count
+
+        def worker(index):
+            results[index] = measure(
+                lambda: pdeathsignal.cloneandexecve(TRUE, None, None), per_thread,
+            )[0]
+
+        workers = [threading.Thread(target=worker, args=(index,)) for index in range(thread_count)]
+        before = time.perf_counter_ns()
+        for thread in workers:
+            thread.start()
+        for thread in workers:
+            thread.join()
+        elapsed = time.perf_counter_ns() - before
+
+        samples = [sample for result in results for sample in result]
+        report('threads=%d cloneandexecve' % thread_count, (samples, elapsed))
+
+
+def case_calls(count, repeat=200):
+    # per-call cost of the argument parsing, the spawn is rejected before any clone()
+    def rejected():
+        try:
+            pdeathsignal.cloneandexecve(TRUE, None, None, signal=signal.SIGTERM, pidfd=True, uid_map=b'0 0 1')
+        except ValueError:
+            pass
+
+    variants = [
+        ('getpdeathsignal()', pdeathsignal.getpdeathsignal),
+        ('setpdeathsignal(0)', lambda: pdeathsignal.setpdeathsignal(0)),
+        ('setpdeathsignal(signal=0)', lambda: pdeathsignal.setpdeathsignal(signal=0)),
+        ('cloneandexecve rejected', rejected),
+    ]
+    clock = time.perf_counter_ns
+    for name, call in variants:
+        samples = []
+        for _ in range(count):
+            before = clock()
+            for _ in range(repeat):
+                call()
+            samples.append((clock() - before) / repeat)
+        samples.sort()
+        print('%-36s %10.0f %9.3f %9.3f %9.3f %9.3f' % (
+            'calls %s' % name,
+            1e9 / percentile(samples, 50) if samples[0] else 0.0,
+            percentile(samples, 50) / 1e3,
+            percentile(samples, 90) / 1e3,
+            percentile(samples, 99) / 1e3,
+            samples[-1] / 1e3,
+        ))
+        sys.stdout.flush()
+
+
+CASES = {
+    'baseline': case_baseline,
+    'flags': case_flags,
+    'env': case_env,
+    'threads': case_threads,
+    'calls': case_calls,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('-n', '--count', type=int, default=1000, help='spawns per case')
+    parser.add_argument('cases', nargs='*', help='cases to run: %s (default all)' % ', '.join(CASES))
+    options = parser.parse_args()
+    unknown = set(options.cases) - set(CASES)
+    if unknown:
+        parser.error('unknown cases: %s' % ', '.join(sorted(unknown)))
+
+    print('%-36s %10s %9s %9s %9s %9s' % ('case', 'spawns/s', 'p50 us', 'p90 us', 'p99 us', 'max us'))
+    for name in (options.cases or list(CASES)):
+        CASES[name](options.count)
+
+
+if __name__ == '__main__':
+    main()
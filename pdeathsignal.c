@@ -23,16 +23,76 @@
 
 #include <Python.h>
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <sched.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 
+#ifndef CLONE_PIDFD
+#   define CLONE_PIDFD 0x00001000
+#endif
+#ifndef CLONE_CLEAR_SIGHAND
+#   define CLONE_CLEAR_SIGHAND 0x100000000ULL
+#endif
+#ifndef CLONE_INTO_CGROUP
+#   define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+#ifndef IOPRIO_CLASS_SHIFT
+#   define IOPRIO_CLASS_SHIFT 13
+#   define IOPRIO_WHO_PROCESS 1
+#   define IOPRIO_CLASS_RT 1
+#   define IOPRIO_CLASS_BE 2
+#   define IOPRIO_CLASS_IDLE 3
+#endif
+#ifndef MPOL_DEFAULT
+#   define MPOL_DEFAULT 0
+#   define MPOL_PREFERRED 1
+#   define MPOL_BIND 2
+#   define MPOL_INTERLEAVE 3
+#   define MPOL_LOCAL 4
+#endif
+#ifndef SYS_clone3
+#   define SYS_clone3 435
+#endif
+#ifndef SYS_pidfd_open
+#   define SYS_pidfd_open 434
+#endif
+#ifndef P_PIDFD
+#   define P_PIDFD 3
+#endif
+#ifndef SYS_close_range
+#   define SYS_close_range 436
+#endif
+#ifndef CLOSE_RANGE_CLOEXEC
+#   define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+#if defined(__x86_64__)
+#   define HAVE_CLONE3_TRAMPOLINE 1
+#endif
+
+
 PyDoc_STRVAR(module_doc, "Get and set the parent process death signal.");
 static const char module_name[] = "pdeathsignal";
 
@@ -43,6 +103,16 @@ static const char module_name[] = "pdeathsignal";
 #   define DocVar(name, signature, desc) PyDoc_STRVAR(name, desc)
 #endif
 
+#if PY_VERSION_HEX >= 0x03070000
+// the hot functions take their arguments as a vector, without a tuple and a dict
+#   define HAVE_FASTCALL 1
+#   define FASTCALL_PARAMETERS PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames
+#   define FASTCALL_FLAGS (METH_FASTCALL | METH_KEYWORDS)
+#else
+#   define FASTCALL_PARAMETERS PyObject *args, PyObject *kwargs
+#   define FASTCALL_FLAGS (METH_VARARGS | METH_KEYWORDS)
+#endif
+
 
 static const char *setpdeathsignal_keywords[] = { "signal", NULL };
 DocVar(
@@ -68,524 +138,7418 @@ DocVar(
     "signal : int\n"
     "    New parent process death signal. 0 if none."
 );
-static PyObject *setpdeathsignal_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *setpdeathsignal_impl(PyObject *self, FASTCALL_PARAMETERS);
+
+
+DocVar(
+    register_at_fork_doc,
+    "register_at_fork(signal=0)",
+    "Set the parent process death signal in every child of fork().\n"
+    "\n"
+    "A pthread_atfork() child handler calls PR_SET_PDEATHSIG before any\n"
+    "Python code runs in the child. If the parent has died before that,\n"
+    "getppid() no longer returns its PID and the child sends itself the\n"
+    "signal right away. This covers os.fork(), multiprocessing and\n"
+    "every other fork() in the process, including the ones of Zygote.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "signal : int\n"
+    "    Death signal of the forked children. 0 to stop setting one.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "int\n"
+    "    The previous signal."
+);
+static PyObject *register_at_fork_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+
+
+// keyword-only options shared by cloneandexecve(), cloneandexecve_many() and SpawnSpec()
+#define SPAWN_OPTIONS_KEYWORDS \
+    "signal", "sibling", "search_path", "setsid", "doublefork", "sigign", \
+    "backend", "pidfd", "env_update", "sigmask", "sigdefault", \
+    "stdin", "stdout", "stderr", "pass_fds", "close_fds", "cgroup", \
+    "cpu_affinity", "sched_policy", "priority", "nice", "numa_policy", \
+    "rlimits", "ioprio", "oom_score_adj", "namespaces", "uid_map", "gid_map"
+
+#if PY_VERSION_HEX >= 0x03030000
+#   define SPAWN_OPTIONS_SIGNATURE \
+    "*, signal=0, sibling=False, search_path=False, " \
+    "setsid=False, doublefork=False, sigign=[], backend='clone', pidfd=False, " \
+    "env_update=None, sigmask=None, sigdefault=[], " \
+    "stdin=None, stdout=None, stderr=None, pass_fds=(), close_fds=False, " \
+    "cgroup=None, cpu_affinity=None, sched_policy=None, priority=0, " \
+    "nice=None, numa_policy=None, rlimits=None, ioprio=None, " \
+    "oom_score_adj=None, namespaces=0, uid_map=None, gid_map=None)"
+#else
+#   define SPAWN_OPTIONS_SIGNATURE \
+    "signal=0, sibling=False, search_path=False, " \
+    "setsid=False, doublefork=False, sigign=[], backend='clone', pidfd=False, " \
+    "env_update=None, sigmask=None, sigdefault=[], " \
+    "stdin=None, stdout=None, stderr=None, pass_fds=(), close_fds=False, " \
+    "cgroup=None, cpu_affinity=None, sched_policy=None, priority=0, " \
+    "nice=None, numa_policy=None, rlimits=None, ioprio=None, " \
+    "oom_score_adj=None, namespaces=0, uid_map=None, gid_map=None)"
+#endif
 
 
 static const char *cloneandexecve_keywords[] = {
-    "path", "args", "env", "signal", "sibling", "search_path",
-    "setsid", "doublefork", "sigign",
+    "path", "args", "env", SPAWN_OPTIONS_KEYWORDS,
     NULL
 };
 DocVar(
     cloneandexecve_doc,
     "cloneandexecve(path, args=None, env=None, "
-#if PY_VERSION_HEX >= 0x03030000
-    "*, "
-#endif
-    "signal=0, sibling=False, search_path=False, "
-    "setsid=False, doublefork=False, sigign=[])",
-    ""
+    SPAWN_OPTIONS_SIGNATURE,
+    "Spawn a child process that executes path.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "path : str or bytes\n"
+    "    Executable of the child.\n"
+    "args : sequence of str or bytes\n"
+    "    Argument vector. [path] if None.\n"
+    "env : sequence of str or bytes\n"
+    "    Environment. The current environment if None.\n"
+    "signal : int\n"
+    "    Parent process death signal of the child.\n"
+    "sibling : bool\n"
+    "    Spawn the child as a sibling of the calling process.\n"
+    "search_path : bool\n"
+    "    Search path in $PATH.\n"
+    "setsid : bool\n"
+    "    Start a new session in the child.\n"
+    "doublefork : bool\n"
+    "    Fork twice, so the child gets reparented. The pid (and pidfd)\n"
+    "    returned are the ones of the grandchild.\n"
+    "sigign : int or iterable of int\n"
+    "    Bitmask or list of signals to ignore in the child.\n"
+    "sigmask : int or iterable of int\n"
+    "    Signal mask of the child. Inherited if None.\n"
+    "sigdefault : int or iterable of int\n"
+    "    Signals to reset to their default action in the child.\n"
+    "stdin, stdout, stderr : int or file object\n"
+    "    File descriptors to use as stdio of the child. Inherited if None.\n"
+    "pass_fds : iterable of int\n"
+    "    File descriptors to keep open in the child, even if they are\n"
+    "    close-on-exec.\n"
+    "close_fds : bool\n"
+    "    Close all other file descriptors above 2 in the child.\n"
+    "backend : str\n"
+    "    One of backends(). Defaults to clone3 if cgroup is given.\n"
+    "cgroup : str, bytes or int\n"
+    "    Path or directory descriptor of a cgroup v2 the child is started\n"
+    "    in (CLONE_INTO_CGROUP), only supported by the clone3 backend.\n"
+    "cpu_affinity : iterable of int\n"
+    "    CPUs the child may run on. Inherited if None.\n"
+    "sched_policy : int\n"
+    "    Scheduling policy of the child, e.g. os.SCHED_FIFO, with the\n"
+    "    static priority. Inherited if None.\n"
+    "nice : int\n"
+    "    Absolute nice value of the child. Inherited if None.\n"
+    "numa_policy : tuple\n"
+    "    (mode, nodes) for set_mempolicy(), mode is one of the MPOL_*\n"
+    "    constants of this module and nodes an iterable of node numbers.\n"
+    "    Inherited if None.\n"
+    "rlimits : mapping\n"
+    "    {resource.RLIMIT_*: limit or (soft, hard)} to set in the child,\n"
+    "    -1 means unlimited.\n"
+    "ioprio : int or tuple\n"
+    "    (class, level) with one of the IOPRIO_CLASS_* constants of this\n"
+    "    module, or an encoded I/O priority. Inherited if None.\n"
+    "oom_score_adj : int\n"
+    "    Written to /proc/self/oom_score_adj in the child.\n"
+    "namespaces : int\n"
+    "    CLONE_NEW* constants of this module, ORed. The child is cloned\n"
+    "    into new namespaces, with doublefork only the grandchild.\n"
+    "uid_map, gid_map : str, bytes or iterable of tuple\n"
+    "    Written to /proc/self/uid_map and gid_map by the child with\n"
+    "    CLONE_NEWUSER, as text or (inside, outside, count) ranges.\n"
+    "    setgroups is denied before gid_map. As the child writes them,\n"
+    "    the kernel only permits mapping the caller's own uid and gid.\n"
+    "pidfd : bool\n"
+    "    Return a pidfd for the child, too.\n"
+    "env_update : mapping\n"
+    "    Variables to set in env, or in a cached copy of the current\n"
+    "    environment if env is None. None values remove a variable.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "int or tuple\n"
+    "    PID of the child, or (PID, pidfd) if pidfd is true. The child\n"
+    "    is left to the caller to reap, even if it has exited already.\n"
+    "\n"
+    "Raises\n"
+    "======\n"
+    "OSError\n"
+    "    With the errno of the step that failed in the child, which\n"
+    "    was reaped already."
 );
-static PyObject *cloneandexecve_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *cloneandexecve_impl(PyObject *self, FASTCALL_PARAMETERS);
 
 
-static PyMethodDef functions_def[] = {
-    { "getpdeathsignal", (PyCFunction) getpdeathsignal_impl, METH_NOARGS, getpdeathsignal_doc },
-    { "setpdeathsignal", (PyCFunction) setpdeathsignal_impl, METH_VARARGS | METH_KEYWORDS, setpdeathsignal_doc },
-    { "cloneandexecve", (PyCFunction) cloneandexecve_impl, METH_VARARGS | METH_KEYWORDS, cloneandexecve_doc },
-    { NULL, NULL, 0, NULL }
+static const char *cloneandexecve_many_keywords[] = {
+    "specs", "env", SPAWN_OPTIONS_KEYWORDS,
+    NULL
 };
+DocVar(
+    cloneandexecve_many_doc,
+    "cloneandexecve_many(specs, env=None, "
+    SPAWN_OPTIONS_SIGNATURE,
+    "Spawn multiple children with the same options in one call.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "specs : sequence\n"
+    "    Each item is either a path, or a tuple (path, args).\n"
+    "env and all keyword arguments\n"
+    "    Shared by all children, see cloneandexecve().\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "list\n"
+    "    One item per spec: the result or the exception of\n"
+    "    cloneandexecve()."
+);
+static PyObject *cloneandexecve_many_impl(PyObject *self, PyObject *args, PyObject *kwargs);
 
-#if PY_MAJOR_VERSION >= 3
-static struct PyModuleDef module_def = {
-    PyModuleDef_HEAD_INIT,
-    module_name,
-    module_doc,
-    0,
-    functions_def,
+
+static const char *spawn_pipeline_keywords[] = {
+    "specs", "env", "pipe_size", "direct", SPAWN_OPTIONS_KEYWORDS,
+    NULL
 };
-#endif
+DocVar(
+    spawn_pipeline_doc,
+    "spawn_pipeline(specs, env=None, pipe_size=None, direct=False, "
+    SPAWN_OPTIONS_SIGNATURE,
+    "Spawn a pipeline, each child's stdout connected to the next one's stdin.\n"
+    "\n"
+    "The pipes are created and wired in C. All children share one new\n"
+    "process group, led by the first child. If any child fails, the\n"
+    "group is killed with SIGKILL, the children are reaped and the\n"
+    "error is raised.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "specs : sequence\n"
+    "    Each item is either a path, or a tuple (path, args).\n"
+    "pipe_size : int\n"
+    "    Capacity of each pipe in bytes, set with F_SETPIPE_SZ.\n"
+    "direct : bool\n"
+    "    Create the pipes with O_DIRECT (packet mode).\n"
+    "env and all keyword arguments\n"
+    "    Shared by all children, see cloneandexecve(). stdin applies to\n"
+    "    the first child and stdout to the last one. setsid and sibling\n"
+    "    are not supported with the process group.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "list\n"
+    "    One result of cloneandexecve() per spec. The first PID is the\n"
+    "    process group."
+);
+static PyObject *spawn_pipeline_impl(PyObject *self, PyObject *args, PyObject *kwargs);
 
-#if PY_MAJOR_VERSION >= 3
-#   define pymalloc(N) PyMem_RawMalloc((N))
-#   define pyfree(P) PyMem_RawFree((P))
-#else
-#   define pymalloc(N) PyMem_Malloc((N))
-#   define pyfree(P) PyMem_Free((P))
-#endif
 
+DocVar(
+    cloneandexecve_nowait_doc,
+    "cloneandexecve_nowait(path, args=None, env=None, "
+    SPAWN_OPTIONS_SIGNATURE,
+    "Start a spawn without waiting for it, see cloneandexecve().\n"
+    "\n"
+    "The vfork suspension and the pidfd handling happen on the\n"
+    "spawner thread of use_spawner_thread(), which is started if\n"
+    "needed, so one thread can issue many spawns and collect their\n"
+    "results later. The child still runs on a CLONE_VFORK clone: it\n"
+    "shares the thread-local errno of the cloning thread until exec,\n"
+    "and only the spawner thread can afford that.\n"
+    "\n"
+    "The arguments are copied and stdio and cgroup descriptors are\n"
+    "duplicated, so they may be closed right away. pass_fds must stay\n"
+    "open until the spawn is done. Spawns are not proxied through\n"
+    "use_helper_process().\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "PendingSpawn\n"
+    "    Handle of the spawn."
+);
+static PyObject *cloneandexecve_nowait_impl(PyObject *self, PyObject *args, PyObject *kwargs);
 
-static PyObject *int_or_errno(bool success, long value) {
-    if (success) {
-#     if PY_MAJOR_VERSION >= 3
-        return PyLong_FromLong(value);
-#     else
-        return PyInt_FromLong(value);
-#     endif
-    } else {
-        return PyErr_SetFromErrno(PyExc_OSError);
-    }
-}
 
+DocVar(
+    pending_spawn_doc,
+    "PendingSpawn",
+    "Handle of a spawn started with cloneandexecve_nowait().\n"
+    "\n"
+    "Dropping an unfinished handle waits for the spawn."
+);
 
-static PyObject *as_bytes(PyObject *value) {
-    if (PyBytes_Check(value)) {
-        Py_INCREF(value);
-        return value;
-    } else if (PyUnicode_Check(value)) {
-        return PyUnicode_AsEncodedString(value, "UTF-8", "strict");
-    } else {
-        return PyErr_Format(PyExc_TypeError, "Expected bytes or unicode, got %s.", value->ob_type->tp_name);
-    }
-}
+DocVar(
+    pending_spawn_fileno_doc,
+    "fileno()",
+    "Return an eventfd that becomes readable when the spawn is done,\n"
+    "e.g. for select() or loop.add_reader(). It is closed with the handle."
+);
 
+DocVar(
+    pending_spawn_done_doc,
+    "done()",
+    "Return True if the spawn is done, without blocking."
+);
 
-static PyObject *object_as_list_of_bytes(PyObject *obj) {
-    PyObject *list = PySequence_List(obj);
-    if (!list) {
-        return NULL;
-    }
+static const char *pending_spawn_result_keywords[] = { "timeout", NULL };
+DocVar(
+    pending_spawn_result_doc,
+    "result(timeout=None)",
+    "Wait for the spawn and return its result.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "timeout : float\n"
+    "    Seconds to wait at most. Forever if None.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "int or tuple\n"
+    "    Like cloneandexecve(). Later calls return the same object, the\n"
+    "    pidfd belongs to the caller once it was returned.\n"
+    "\n"
+    "Raises\n"
+    "======\n"
+    "OSError\n"
+    "    Like cloneandexecve().\n"
+    "TimeoutError\n"
+    "    If the spawn is not done within timeout."
+);
 
-    Py_ssize_t length = PyList_GET_SIZE(list);
-    for (Py_ssize_t index = 0; index < length; ++index) {
-        PyObject *elem = PyList_GET_ITEM(list, index);
-        PyObject *bytes = as_bytes(elem);
-        if (!bytes) {
-            return NULL;
-        }
-        PyList_SET_ITEM(list, index, bytes);
-        Py_DECREF(elem);
-    }
+static void pending_spawn_dealloc(PyObject *self);
+static PyObject *pending_spawn_fileno_impl(PyObject *self, PyObject *no_args);
+static PyObject *pending_spawn_done_impl(PyObject *self, PyObject *no_args);
+static PyObject *pending_spawn_result_impl(PyObject *self, PyObject *args, PyObject *kwargs);
 
-    return list;
-}
+static PyMethodDef pending_spawn_methods_def[] = {
+    { "fileno", (PyCFunction) pending_spawn_fileno_impl, METH_NOARGS, pending_spawn_fileno_doc },
+    { "done", (PyCFunction) pending_spawn_done_impl, METH_NOARGS, pending_spawn_done_doc },
+    { "result", (PyCFunction) pending_spawn_result_impl, METH_VARARGS | METH_KEYWORDS, pending_spawn_result_doc },
+    { NULL, NULL, 0, NULL }
+};
 
 
-static char **bytes_list_to_cstring_array(PyObject *list) {
-    if (!list) {
-        return NULL;
-    }
+DocVar(
+    backends_doc,
+    "backends()",
+    "Return the spawn backends usable on the running kernel.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "tuple of str\n"
+    "    Subset of ('clone', 'clone3', 'posix_spawn')."
+);
+static PyObject *backends_impl(PyObject *self, PyObject *no_args);
 
-    Py_ssize_t length = PyList_GET_SIZE(list);
-    char **result = pymalloc(sizeof(char*) * (length + 1));
-    if (!result) {
-        PyErr_NoMemory();
-        return NULL;
-    }
 
-    result[length] = NULL;
-    for (Py_ssize_t index = 0; index < length; ++index) {
-        PyObject *elem = PyList_GET_ITEM(list, index);
-        result[index] = PyBytes_AS_STRING(elem);
-    }
+DocVar(
+    refresh_environ_doc,
+    "refresh_environ()",
+    "Drop the cached copy of the environment used by env_update.\n"
+    "\n"
+    "Call this after the environment of the current process changed.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "int\n"
+    "    Generation number of the environment."
+);
+static PyObject *refresh_environ_impl(PyObject *self, PyObject *no_args);
 
-    return result;
-}
 
+DocVar(
+    clear_path_cache_doc,
+    "clear_path_cache()",
+    "Forget all executables that search_path=True has resolved.\n"
+    "\n"
+    "Cache entries are revalidated against the directories in $PATH\n"
+    "anyway, this is only needed if an executable was replaced in place."
+);
+static PyObject *clear_path_cache_impl(PyObject *self, PyObject *no_args);
 
-static int path_converter(PyObject *input, PyObject **output) {
-#if PY_VERSION_HEX >= 0x03010000
-    return PyUnicode_FSConverter(input, output);
-#else
-    PyObject *result = as_bytes(input);
-    if (result) {
-        *output = result;
-        return true;
-    }
-    return false;
-#endif
-}
 
+static const char *set_spawn_stats_keywords[] = {
+    "enabled",
+    NULL
+};
+DocVar(
+    set_spawn_stats_doc,
+    "set_spawn_stats(enabled)",
+    "Enable or disable spawn latency statistics.\n"
+    "\n"
+    "Disabled by default. When enabled, every spawn takes a few\n"
+    "monotonic timestamps and updates counters with atomic operations.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "bool\n"
+    "    The previous setting."
+);
+static PyObject *set_spawn_stats_impl(PyObject *self, PyObject *args, PyObject *kwargs);
 
-static int bytes_list_converter(PyObject *obj, PyObject **list) {
-    if (!obj || (obj == Py_None)) {
-        *list = NULL;
-        return true;
-    }
 
-    PyObject *temp = object_as_list_of_bytes(obj);
-    *list = temp;
-    return temp != NULL;
-}
+static const char *get_spawn_stats_keywords[] = {
+    "reset",
+    NULL
+};
+DocVar(
+    get_spawn_stats_doc,
+    "get_spawn_stats(reset=False)",
+    "Return the spawn statistics collected since the last reset.\n"
+    "\n"
+    "Phases, in nanoseconds:\n"
+    "prepare\n"
+    "    Argument conversion until the spawn starts.\n"
+    "clone\n"
+    "    Spawn start until the child runs the trampoline.\n"
+    "child\n"
+    "    Trampoline until just before exec.\n"
+    "exec\n"
+    "    exec until the parent resumes (vfork suspension).\n"
+    "spawn\n"
+    "    Spawn start until the parent resumes.\n"
+    "wait\n"
+    "    Parent resume until the result is ready, e.g. the pidfd.\n"
+    "\n"
+    "The child phases are not measured for posix_spawn.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "reset : bool\n"
+    "    Clear the statistics after reading them.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "dict\n"
+    "    'spawns', 'failures', 'failures_by_fun' ({fun: count}) and\n"
+    "    'phases' ({phase: {'count', 'total_ns', 'max_ns', 'p50_ns',\n"
+    "    'p99_ns', 'histogram'}}). Percentiles are upper bounds of the\n"
+    "    histogram buckets, bucket i counts durations below 2**i ns."
+);
+static PyObject *get_spawn_stats_impl(PyObject *self, PyObject *args, PyObject *kwargs);
 
 
-static int bool_false_converter(PyObject *obj, bool *result) {
-    if (!obj || (obj == Py_None)) {
-        *result = false;
-    } else {
-        int value = PyObject_IsTrue(obj);
-        if (value < 0) {
-            return false;
-        }
-        *result = value != 0;
-    }
-    return true;
-}
+static const char *use_spawner_thread_keywords[] = {
+    "enabled",
+    NULL
+};
+DocVar(
+    use_spawner_thread_doc,
+    "use_spawner_thread(enabled=True)",
+    "Run all spawns on a dedicated native thread of this module.\n"
+    "\n"
+    "PR_SET_PDEATHSIG fires when the thread that spawned the child\n"
+    "exits. With the spawner thread, which lives as long as the\n"
+    "process, the death signal follows the process lifetime, even if\n"
+    "spawns come from short-lived threads. Callers hand their spawns\n"
+    "to it through a lock-free queue and wait without the GIL.\n"
+    "\n"
+    "Children get the signal mask of the calling thread, unless\n"
+    "sigmask is given. After os.fork() the child process spawns\n"
+    "without the thread again.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "bool\n"
+    "    The previous setting."
+);
+static PyObject *use_spawner_thread_impl(PyObject *self, PyObject *args, PyObject *kwargs);
 
 
-static bool pylong_to_signum(PyObject *obj, int *result) {
-    long value;
-#if PY_MAJOR_VERSION >= 3
-    value = PyLong_AsLong(obj);
-#else
-    value = PyInt_AsLong(obj);
-#endif
-    if ((value < 0) || (value > _NSIG)) {
-        if (!((value == -1) || PyErr_Occurred())) {
-            PyErr_Format(
-                PyExc_OverflowError, "Signal number out of range: not (0 <= %zd <= %d)",
-                value, _NSIG
-            );
-        }
-        return false;
-    }
-    *result = (int) value;
-    return true;
-}
+static const char *use_helper_process_keywords[] = {
+    "enabled",
+    NULL
+};
+DocVar(
+    use_helper_process_doc,
+    "use_helper_process(enabled=True)",
+    "Proxy all spawns through a small helper process.\n"
+    "\n"
+    "A clone copies the page tables of the spawning process and\n"
+    "contends with its faulting threads, so spawn latency grows with\n"
+    "the address space of a large parent. The helper is a fresh\n"
+    "interpreter (python -E -s -S) started with cloneandexecve() and\n"
+    "signal=SIGKILL on the first spawn after enabling. It clones with\n"
+    "CLONE_PARENT, the children are still children of this process.\n"
+    "\n"
+    "The helper is tied to the thread that started it, like the death\n"
+    "signal of its children, so combine it with use_spawner_thread()\n"
+    "if spawns come from short-lived threads. stdio, cgroup and the\n"
+    "environment are passed along, but the children start in the\n"
+    "working directory the helper was started in. Spawns with\n"
+    "pass_fds, sibling, doublefork or the posix_spawn backend are not\n"
+    "proxied. The helper's spawns are not counted in get_spawn_stats().\n"
+    "Each thread has its own connection, served by a thread of the\n"
+    "helper, so concurrent spawns do not wait for each other.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "bool\n"
+    "    The previous setting."
+);
+static PyObject *use_helper_process_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+
+
+DocVar(
+    helper_main_doc,
+    "_helper_main()",
+    "Serve the spawn requests of use_helper_process() on stdin. Does not return.\n"
+    "\n"
+    "Raises\n"
+    "======\n"
+    "RuntimeError\n"
+    "    If the process was not started by use_helper_process()."
+);
+static PyObject *helper_main_impl(PyObject *self, PyObject *no_args);
+
+
+static const char *reap_keywords[] = {
+    "children",
+    "timeout",
+    NULL
+};
+DocVar(
+    reap_doc,
+    "reap(children, timeout=None)",
+    "Wait for children to exit and collect their resource usage.\n"
+    "\n"
+    "Waiting and reaping happen without the GIL: the pidfds are polled\n"
+    "and the exited children are reaped with waitid(), which returns their\n"
+    "rusage as well. Children that are not ours, or were reaped already,\n"
+    "are left out of the result.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "children : iterable of int or (int, int)\n"
+    "    PIDs, or (pid, pidfd) as returned by cloneandexecve(..., pidfd=True).\n"
+    "    The pidfds are not closed.\n"
+    "timeout : float\n"
+    "    Seconds to wait at most. None waits until all children have\n"
+    "    exited, 0 only reaps the ones that have exited already.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "list of dict\n"
+    "    One dict per reaped child, in the order of children: 'pid',\n"
+    "    'status' (encoded like os.waitpid()), 'utime' and 'stime' (seconds),\n"
+    "    'maxrss' (KiB), 'minflt', 'majflt', 'inblock', 'oublock', 'nvcsw',\n"
+    "    'nivcsw' and 'duration', the seconds from the spawn until the child\n"
+    "    was reaped. The duration is None if the spawn was not recorded,\n"
+    "    e.g. for children of os.fork() or subprocess."
+);
+static PyObject *reap_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+
+
+#if PY_VERSION_HEX >= 0x03070000
+DocVar(
+    wait_async_doc,
+    "wait_async(pidfd)",
+    "Wait for a child to exit in the running asyncio event loop.\n"
+    "\n"
+    "The pidfd is registered with the loop's selector, no thread or\n"
+    "SIGCHLD handler is involved. The pidfd is not closed.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "pidfd : int\n"
+    "    As returned by cloneandexecve(..., pidfd=True).\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "asyncio.Future\n"
+    "    Resolves to the exit status, encoded like os.waitpid()."
+);
+static PyObject *wait_async_impl(PyObject *self, PyObject *pidfd);
+#endif
+
+
+static PyMethodDef functions_def[] = {
+    { "getpdeathsignal", (PyCFunction) getpdeathsignal_impl, METH_NOARGS, getpdeathsignal_doc },
+    { "setpdeathsignal", (PyCFunction) setpdeathsignal_impl, FASTCALL_FLAGS, setpdeathsignal_doc },
+    { "register_at_fork", (PyCFunction) register_at_fork_impl, METH_VARARGS | METH_KEYWORDS, register_at_fork_doc },
+    { "cloneandexecve", (PyCFunction) cloneandexecve_impl, FASTCALL_FLAGS, cloneandexecve_doc },
+    { "cloneandexecve_many", (PyCFunction) cloneandexecve_many_impl, METH_VARARGS | METH_KEYWORDS, cloneandexecve_many_doc },
+    {
+        "cloneandexecve_nowait", (PyCFunction) cloneandexecve_nowait_impl, METH_VARARGS | METH_KEYWORDS,
+        cloneandexecve_nowait_doc
+    },
+    { "spawn_pipeline", (PyCFunction) spawn_pipeline_impl, METH_VARARGS | METH_KEYWORDS, spawn_pipeline_doc },
+    { "backends", (PyCFunction) backends_impl, METH_NOARGS, backends_doc },
+    { "refresh_environ", (PyCFunction) refresh_environ_impl, METH_NOARGS, refresh_environ_doc },
+    { "clear_path_cache", (PyCFunction) clear_path_cache_impl, METH_NOARGS, clear_path_cache_doc },
+    { "set_spawn_stats", (PyCFunction) set_spawn_stats_impl, METH_VARARGS | METH_KEYWORDS, set_spawn_stats_doc },
+    { "get_spawn_stats", (PyCFunction) get_spawn_stats_impl, METH_VARARGS | METH_KEYWORDS, get_spawn_stats_doc },
+    {
+        "use_spawner_thread", (PyCFunction) use_spawner_thread_impl, METH_VARARGS | METH_KEYWORDS,
+        use_spawner_thread_doc
+    },
+    {
+        "use_helper_process", (PyCFunction) use_helper_process_impl, METH_VARARGS | METH_KEYWORDS,
+        use_helper_process_doc
+    },
+    { "_helper_main", (PyCFunction) helper_main_impl, METH_NOARGS, helper_main_doc },
+    { "reap", (PyCFunction) reap_impl, METH_VARARGS | METH_KEYWORDS, reap_doc },
+#if PY_VERSION_HEX >= 0x03070000
+    { "wait_async", (PyCFunction) wait_async_impl, METH_O, wait_async_doc },
+#endif
+    { NULL, NULL, 0, NULL }
+};
+
+
+DocVar(
+    spawnspec_doc,
+    "SpawnSpec(path, args=None, env=None, "
+    SPAWN_OPTIONS_SIGNATURE,
+    "Reusable, pre-converted arguments of cloneandexecve().\n"
+    "\n"
+    "The arguments are converted and copied into C memory once, so\n"
+    "spawn() does not need to touch them again. A SpawnSpec cannot be\n"
+    "initialized twice, spawn() may use the copies without the GIL."
+);
+
+static const char *spawnspec_spawn_keywords[] = { "extra_args", NULL };
+DocVar(
+    spawnspec_spawn_doc,
+    "spawn(extra_args=None)",
+    "Spawn a child, see cloneandexecve().\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "extra_args : sequence of str or bytes\n"
+    "    Appended to the argument vector of this call only."
+);
+
+static int spawnspec_init(PyObject *self, PyObject *args, PyObject *kwargs);
+static void spawnspec_dealloc(PyObject *self);
+static PyObject *spawnspec_spawn_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+
+static PyMethodDef spawnspec_methods_def[] = {
+    { "spawn", (PyCFunction) spawnspec_spawn_impl, METH_VARARGS | METH_KEYWORDS, spawnspec_spawn_doc },
+    { NULL, NULL, 0, NULL }
+};
+
+
+static const char *supervisor_keywords[] = { "subreaper", NULL };
+DocVar(
+    supervisor_doc,
+    "Supervisor(subreaper=True)",
+    "Spawn children into one process group and tear them down together.\n"
+    "\n"
+    "The first child becomes the group leader, later children join its\n"
+    "group. Children must be reaped through the supervisor, it only\n"
+    "signals the group while it still has an unreaped child in it.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "subreaper : bool\n"
+    "    Make this process a child subreaper (PR_SET_CHILD_SUBREAPER),\n"
+    "    so orphaned descendants, e.g. of doublefork=True, are reparented\n"
+    "    to it. This is a process-wide setting and is not undone."
+);
+
+DocVar(
+    supervisor_spawn_doc,
+    "spawn(path, args=None, env=None, "
+    SPAWN_OPTIONS_SIGNATURE,
+    "Spawn a child into the group, see cloneandexecve().\n"
+    "\n"
+    "setsid and sibling are not supported, the child would leave the\n"
+    "group or not be a child of the supervisor."
+);
+
+static const char *supervisor_reap_all_keywords[] = { "block", NULL };
+DocVar(
+    supervisor_reap_all_doc,
+    "reap_all(block=False)",
+    "Reap the exited children of the group.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "block : bool\n"
+    "    Wait until no child is left in the group.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "list of tuple\n"
+    "    (pid, status) of each reaped child, status encoded like\n"
+    "    os.waitpid()."
+);
+
+static const char *supervisor_terminate_all_keywords[] = { "signal", "grace", NULL };
+DocVar(
+    supervisor_terminate_all_doc,
+    "terminate_all(signal=SIGTERM, grace=None)",
+    "Signal the whole group with a single kill(-pgid) and reap it.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "signal : int\n"
+    "    Signal to send first.\n"
+    "grace : float\n"
+    "    Seconds to wait for the children to exit before the group is\n"
+    "    sent SIGKILL and reaped completely. If None, only the children\n"
+    "    that have exited already are reaped.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "list of tuple\n"
+    "    See reap_all()."
+);
+
+static int supervisor_init(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *supervisor_spawn_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *supervisor_reap_all_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *supervisor_terminate_all_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *supervisor_get_pgid(PyObject *self, void *closure);
+
+static PyMethodDef supervisor_methods_def[] = {
+    { "spawn", (PyCFunction) supervisor_spawn_impl, METH_VARARGS | METH_KEYWORDS, supervisor_spawn_doc },
+    { "reap_all", (PyCFunction) supervisor_reap_all_impl, METH_VARARGS | METH_KEYWORDS, supervisor_reap_all_doc },
+    {
+        "terminate_all", (PyCFunction) supervisor_terminate_all_impl, METH_VARARGS | METH_KEYWORDS,
+        supervisor_terminate_all_doc
+    },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef supervisor_getset_def[] = {
+    { "pgid", supervisor_get_pgid, NULL, "Process group of the children, or None.", NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+
+static const char *zygote_keywords[] = { "target", "signal", NULL };
+DocVar(
+    zygote_doc,
+    "Zygote(target, signal=SIGKILL)",
+    "Fork server for pre-initialized Python workers.\n"
+    "\n"
+    "The calling process is forked once into a zygote, which keeps\n"
+    "everything imported so far. Each spawn() forks the zygote again\n"
+    "and calls target(payload) in the new worker, which exits with the\n"
+    "returned int (0 for None, 1 for an exception). Dispatching a worker\n"
+    "costs a fork, not an exec and the imports.\n"
+    "\n"
+    "Create the zygote before starting threads, like for os.fork().\n"
+    "The workers are children of the zygote, which reaps them. The exit\n"
+    "status of the workers spawned with pidfd=True is sent back, see\n"
+    "wait().\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "target : callable\n"
+    "    Called with the payload bytes in each worker.\n"
+    "signal : int\n"
+    "    Death signal of the zygote when this process exits. The zygote\n"
+    "    also exits when the zygote is closed."
+);
+
+static const char *zygote_spawn_keywords[] = { "payload", "signal", "setsid", "sigign", "pidfd", NULL };
+DocVar(
+    zygote_spawn_doc,
+#if PY_VERSION_HEX >= 0x03030000
+    "spawn(payload=b'', *, signal=0, setsid=False, sigign=[], pidfd=False)",
+#else
+    "spawn(payload=b'', signal=0, setsid=False, sigign=[], pidfd=False)",
+#endif
+    "Fork a worker from the zygote.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "payload : bytes\n"
+    "    Passed to target, at most 64 KiB.\n"
+    "signal : int\n"
+    "    Death signal of the worker when the zygote exits.\n"
+    "setsid, sigign\n"
+    "    See cloneandexecve().\n"
+    "pidfd : bool\n"
+    "    Return a pidfd for the worker, too, passed with SCM_RIGHTS. The\n"
+    "    worker is not a child of this process, the pidfd can be polled\n"
+    "    and signalled, but reap(), wait_async() and os.waitid() fail\n"
+    "    with ECHILD. Its exit status is returned by wait() instead.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "int or tuple\n"
+    "    PID of the worker, or (PID, pidfd) if pidfd is true."
+);
+
+static const char *zygote_wait_keywords[] = { "timeout", NULL };
+DocVar(
+    zygote_wait_doc,
+    "wait(timeout=None)",
+    "Return the exit status of a worker spawned with pidfd=True.\n"
+    "\n"
+    "The zygote reaps the workers and queues their status in the order\n"
+    "they exit, until it is collected here.\n"
+    "\n"
+    "Arguments\n"
+    "=========\n"
+    "timeout : float\n"
+    "    Seconds to wait at most. Forever if None.\n"
+    "\n"
+    "Returns\n"
+    "=======\n"
+    "tuple or None\n"
+    "    (pid, status), the status encoded like os.waitpid(), or None if\n"
+    "    no worker exited within timeout."
+);
+
+DocVar(
+    zygote_close_doc,
+    "close()",
+    "Stop the zygote and wait for it to exit. Running workers are not\n"
+    "affected, unless they were spawned with a signal."
+);
+
+static int zygote_init(PyObject *self, PyObject *args, PyObject *kwargs);
+static void zygote_dealloc(PyObject *self);
+static PyObject *zygote_spawn_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *zygote_close_impl(PyObject *self, PyObject *no_args);
+static PyObject *zygote_wait_impl(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *zygote_get_pid(PyObject *self, void *closure);
+
+static PyMethodDef zygote_methods_def[] = {
+    { "spawn", (PyCFunction) zygote_spawn_impl, METH_VARARGS | METH_KEYWORDS, zygote_spawn_doc },
+    { "close", (PyCFunction) zygote_close_impl, METH_NOARGS, zygote_close_doc },
+    { "wait", (PyCFunction) zygote_wait_impl, METH_VARARGS | METH_KEYWORDS, zygote_wait_doc },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef zygote_getset_def[] = {
+    { "pid", zygote_get_pid, NULL, "PID of the zygote, or None if closed.", NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+
+#if PY_VERSION_HEX >= 0x03090000
+// per-module state and heap types, every interpreter gets its own copy
+#   define HAVE_MODULE_STATE 1
+#endif
+
+#ifdef Py_TPFLAGS_IMMUTABLETYPE
+// as immutable as the static types they replace
+#   define TYPE_FLAGS Py_TPFLAGS_IMMUTABLETYPE
+#else
+#   define TYPE_FLAGS 0
+#endif
+#ifdef Py_TPFLAGS_DISALLOW_INSTANTIATION
+#   define TYPE_FLAGS_INTERNAL (TYPE_FLAGS | Py_TPFLAGS_DISALLOW_INSTANTIATION)
+#else
+#   define TYPE_FLAGS_INTERNAL TYPE_FLAGS
+#endif
+
+#if PY_VERSION_HEX < 0x030D0000
+// the GIL serializes the objects without free-threading
+#   define Py_BEGIN_CRITICAL_SECTION(op) { (void) (op);
+#   define Py_END_CRITICAL_SECTION() }
+#endif
+
+
+typedef struct {
+    // frozen copy of environ, shared by all spawns with env_update
+    PyObject *environ_snapshot;
+    unsigned long environ_generation;
+    // (name, $PATH) -> (resolved path, directory stamps)
+    PyObject *path_cache;
+    // interned keyword names of the FASTCALL functions
+    PyObject *setpdeathsignal_kwnames;
+    PyObject *cloneandexecve_kwnames;
+#if PY_VERSION_HEX >= 0x030D0000
+    // guards the caches, the GIL does not exist in free-threaded builds
+    PyMutex cache_lock;
+#endif
+    PyTypeObject *spawnspec_type;
+    PyTypeObject *supervisor_type;
+    PyTypeObject *zygote_type;
+    PyTypeObject *pending_spawn_type;
+} ModuleState;
+
+#if PY_VERSION_HEX >= 0x030D0000
+#   define cache_lock(STATE) PyMutex_Lock(&(STATE)->cache_lock)
+#   define cache_unlock(STATE) PyMutex_Unlock(&(STATE)->cache_lock)
+#else
+#   define cache_lock(STATE) ((void) (STATE))
+#   define cache_unlock(STATE) ((void) (STATE))
+#endif
+
+#ifndef HAVE_MODULE_STATE
+static ModuleState module_state_static;
+#endif
+
+
+static int module_exec(PyObject *module);
+#ifdef HAVE_MODULE_STATE
+static int module_traverse(PyObject *module, visitproc visit, void *arg);
+static int module_clear(PyObject *module);
+static void module_free(void *module);
+#endif
+
+#if PY_VERSION_HEX >= 0x03050000
+static PyModuleDef_Slot module_slots[] = {
+    { Py_mod_exec, module_exec },
+#   if PY_VERSION_HEX >= 0x030C0000
+    { Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#   endif
+#   if PY_VERSION_HEX >= 0x030D0000
+    { Py_mod_gil, Py_MOD_GIL_NOT_USED },
+#   endif
+    { 0, NULL }
+};
+#endif
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT,
+    module_name,
+    module_doc,
+#   ifdef HAVE_MODULE_STATE
+    sizeof(ModuleState),
+#   else
+    0,
+#   endif
+    functions_def,
+#   if PY_VERSION_HEX >= 0x03050000
+    module_slots,
+#   endif
+#   ifdef HAVE_MODULE_STATE
+    module_traverse,
+    module_clear,
+    module_free,
+#   endif
+};
+#endif
+
+
+static ModuleState *module_state(PyObject *module) {
+#ifdef HAVE_MODULE_STATE
+    return (ModuleState*) PyModule_GetState(module);
+#else
+    (void) module;
+    return &module_state_static;
+#endif
+}
+
+
+// the state of the module that created the type of self
+static ModuleState *object_state(PyObject *self) {
+#ifdef HAVE_MODULE_STATE
+    return (ModuleState*) PyType_GetModuleState(Py_TYPE(self));
+#else
+    (void) self;
+    return &module_state_static;
+#endif
+}
+
+
+static void object_free(PyObject *self) {
+    PyTypeObject *type = Py_TYPE(self);
+    type->tp_free(self);
+#ifdef HAVE_MODULE_STATE
+    // instances of heap types own a reference to their type
+    Py_DECREF(type);
+#endif
+}
+
+#if PY_MAJOR_VERSION >= 3
+#   define pymalloc(N) PyMem_RawMalloc((N))
+#   define pyfree(P) PyMem_RawFree((P))
+#else
+#   define pymalloc(N) PyMem_Malloc((N))
+#   define pyfree(P) PyMem_Free((P))
+#endif
+
+
+static PyObject *int_or_errno(bool success, long value) {
+    if (success) {
+#     if PY_MAJOR_VERSION >= 3
+        return PyLong_FromLong(value);
+#     else
+        return PyInt_FromLong(value);
+#     endif
+    } else {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+}
+
+
+static PyObject *as_bytes(PyObject *value) {
+    if (PyBytes_Check(value)) {
+        Py_INCREF(value);
+        return value;
+    } else if (PyUnicode_Check(value)) {
+        return PyUnicode_AsEncodedString(value, "UTF-8", "strict");
+    } else {
+        return PyErr_Format(PyExc_TypeError, "Expected bytes or unicode, got %s.", value->ob_type->tp_name);
+    }
+}
+
+
+static PyObject *object_as_list_of_bytes(PyObject *obj) {
+    PyObject *list = PySequence_List(obj);
+    if (!list) {
+        return NULL;
+    }
+
+    Py_ssize_t length = PyList_GET_SIZE(list);
+    for (Py_ssize_t index = 0; index < length; ++index) {
+        PyObject *elem = PyList_GET_ITEM(list, index);
+        PyObject *bytes = as_bytes(elem);
+        if (!bytes) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, index, bytes);
+        Py_DECREF(elem);
+    }
+
+    return list;
+}
+
+
+/*
+ * Arrays up to this length are kept in the CStringArray itself, which
+ * lives on the caller's stack.
+ */
+#define CSTRING_ARRAY_INLINE 128
+
+typedef struct {
+    PyObject *owner;
+    char **items;
+    char *inline_items[CSTRING_ARRAY_INLINE + 1];
+} CStringArray;
+
+
+static bool all_bytes(PyObject **elems, Py_ssize_t length) {
+    for (Py_ssize_t index = 0; index < length; ++index) {
+        if (!PyBytes_Check(elems[index])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static int cstring_array_converter(PyObject *obj, CStringArray *array) {
+    array->owner = NULL;
+    array->items = NULL;
+    if (!obj || (obj == Py_None)) {
+        return true;
+    }
+
+    PyObject *owner = NULL;
+    if (PyTuple_CheckExact(obj)) {
+        if (all_bytes(PySequence_Fast_ITEMS(obj), PyTuple_GET_SIZE(obj))) {
+            // tuples are immutable, so the buffers can be borrowed directly
+            Py_INCREF(obj);
+            owner = obj;
+        }
+    } else if (PyList_CheckExact(obj)) {
+        if (all_bytes(PySequence_Fast_ITEMS(obj), PyList_GET_SIZE(obj))) {
+            // the list could be mutated while the GIL is released
+            owner = PyList_AsTuple(obj);
+            if (!owner) {
+                return false;
+            }
+        }
+    }
+    if (!owner) {
+        owner = object_as_list_of_bytes(obj);
+        if (!owner) {
+            return false;
+        }
+    }
+
+    Py_ssize_t length = PySequence_Fast_GET_SIZE(owner);
+    PyObject **elems = PySequence_Fast_ITEMS(owner);
+    char **items = array->inline_items;
+    if (length > CSTRING_ARRAY_INLINE) {
+        items = pymalloc(sizeof(char*) * (length + 1));
+        if (!items) {
+            Py_DECREF(owner);
+            PyErr_NoMemory();
+            return false;
+        }
+    }
+    for (Py_ssize_t index = 0; index < length; ++index) {
+        items[index] = PyBytes_AS_STRING(elems[index]);
+    }
+    items[length] = NULL;
+
+    array->owner = owner;
+    array->items = items;
+    return true;
+}
+
+
+static void cstring_array_clear(CStringArray *array) {
+    if (array->items != array->inline_items) {
+        pyfree(array->items);
+    }
+    array->items = NULL;
+    Py_CLEAR(array->owner);
+}
+
+
+static char *cstring_copy(const char *source) {
+    size_t length = strlen(source) + 1;
+    char *result = pymalloc(length);
+    if (!result) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    memcpy(result, source, length);
+    return result;
+}
+
+
+// copies a NULL terminated array and its strings into a single allocation
+static char **cstring_array_freeze(char *const *source) {
+    size_t count = 0;
+    size_t size = 0;
+    for (; source && source[count]; ++count) {
+        size += strlen(source[count]) + 1;
+    }
+
+    char **result = pymalloc(sizeof(char*) * (count + 1) + size);
+    if (!result) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    char *buffer = (char*) (result + count + 1);
+    for (size_t index = 0; index < count; ++index) {
+        size_t length = strlen(source[index]) + 1;
+        memcpy(buffer, source[index], length);
+        result[index] = buffer;
+        buffer += length;
+    }
+    result[count] = NULL;
+    return result;
+}
+
+
+static void environ_snapshot_free(PyObject *capsule) {
+    pyfree(PyCapsule_GetPointer(capsule, NULL));
+}
+
+
+static PyObject *environ_snapshot_get(ModuleState *state) {
+    cache_lock(state);
+    if (!state->environ_snapshot) {
+        char **frozen = cstring_array_freeze(environ);
+        if (frozen) {
+            state->environ_snapshot = PyCapsule_New(frozen, NULL, environ_snapshot_free);
+            if (!state->environ_snapshot) {
+                pyfree(frozen);
+            }
+        }
+    }
+    PyObject *snapshot = state->environ_snapshot;
+    Py_XINCREF(snapshot);
+    cache_unlock(state);
+    return snapshot;
+}
+
+
+static int env_update_converter(PyObject *obj, PyObject **result) {
+    if (!obj || (obj == Py_None)) {
+        *result = NULL;
+        return true;
+    }
+    *result = PyMapping_Items(obj);
+    return *result != NULL;
+}
+
+
+/*
+ * Merges the (key, value) list update into base, or into the environ
+ * snapshot if base is NULL. A value of None removes the key.
+ */
+static bool environ_merge(ModuleState *state, char **base, PyObject *update, CStringArray *array) {
+    bool success = false;
+    PyObject *snapshot = NULL;
+    PyObject *keys = NULL;
+    PyObject *entries = NULL;
+
+    array->owner = NULL;
+    array->items = NULL;
+
+    if (!base) {
+        snapshot = environ_snapshot_get(state);
+        if (!snapshot) {
+            goto end;
+        }
+        base = PyCapsule_GetPointer(snapshot, NULL);
+    }
+
+    Py_ssize_t update_count = PyList_GET_SIZE(update);
+    keys = PyTuple_New(update_count);
+    entries = PyList_New(0);
+    if (!keys || !entries) {
+        goto end;
+    }
+    for (Py_ssize_t index = 0; index < update_count; ++index) {
+        PyObject *item = PyList_GET_ITEM(update, index);
+        PyObject *key, *value;
+        if (!PyArg_ParseTuple(item, "OO:env_update", &key, &value)) {
+            goto end;
+        }
+        key = as_bytes(key);
+        if (!key) {
+            goto end;
+        }
+        PyTuple_SET_ITEM(keys, index, key);
+        if ((PyBytes_GET_SIZE(key) == 0) || strchr(PyBytes_AS_STRING(key), '=')) {
+            PyErr_Format(PyExc_ValueError, "Illegal environment variable name: %R", key);
+            goto end;
+        }
+        if (value == Py_None) {
+            continue;
+        }
+
+        value = as_bytes(value);
+        if (!value) {
+            goto end;
+        }
+        PyObject *entry = PyBytes_FromFormat("%s=%s", PyBytes_AS_STRING(key), PyBytes_AS_STRING(value));
+        Py_DECREF(value);
+        if (!entry) {
+            goto end;
+        }
+        int appended = PyList_Append(entries, entry);
+        Py_DECREF(entry);
+        if (appended < 0) {
+            goto end;
+        }
+    }
+
+    Py_ssize_t base_count = 0;
+    while (base[base_count]) {
+        ++base_count;
+    }
+    Py_ssize_t entry_count = PyList_GET_SIZE(entries);
+    Py_ssize_t length = base_count + entry_count;
+    char **items = array->inline_items;
+    if (length > CSTRING_ARRAY_INLINE) {
+        items = pymalloc(sizeof(char*) * (length + 1));
+        if (!items) {
+            PyErr_NoMemory();
+            goto end;
+        }
+    }
+
+    Py_ssize_t count = 0;
+    for (Py_ssize_t index = 0; index < base_count; ++index) {
+        const char *variable = base[index];
+        const char *equals = strchr(variable, '=');
+        size_t name_length = equals ? (size_t) (equals - variable) : strlen(variable);
+        bool replaced = false;
+        for (Py_ssize_t key_index = 0; key_index < update_count; ++key_index) {
+            PyObject *key = PyTuple_GET_ITEM(keys, key_index);
+            if (
+                ((size_t) PyBytes_GET_SIZE(key) == name_length) &&
+                (memcmp(PyBytes_AS_STRING(key), variable, name_length) == 0)
+            ) {
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) {
+            items[count++] = (char*) variable;
+        }
+    }
+    for (Py_ssize_t index = 0; index < entry_count; ++index) {
+        items[count++] = PyBytes_AS_STRING(PyList_GET_ITEM(entries, index));
+    }
+    items[count] = NULL;
+
+    array->owner = Py_BuildValue("(OO)", snapshot ? snapshot : Py_None, entries);
+    if (!array->owner) {
+        if (items != array->inline_items) {
+            pyfree(items);
+        }
+        goto end;
+    }
+    array->items = items;
+    success = true;
+
+  end:
+    Py_XDECREF(snapshot);
+    Py_XDECREF(keys);
+    Py_XDECREF(entries);
+    return success;
+}
+
+
+/*
+ * Executables found in $PATH are cached, keyed by (name, $PATH). Every
+ * directory searched up to the hit is stamped, so that a later lookup
+ * notices if one of them changed.
+ */
+#define PATH_CACHE_MAX 256
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime_sec;
+    long mtime_nsec;
+} DirStamp;
+
+
+static bool dir_stamp(const char *dir, size_t length, DirStamp *stamp) {
+    char buffer[PATH_MAX];
+    if (length >= sizeof(buffer)) {
+        return false;
+    }
+    memcpy(buffer, dir, length);
+    buffer[length] = '\0';
+
+    struct stat st;
+    memset(stamp, 0, sizeof(*stamp));
+    if (stat(buffer, &st) == 0) {
+        stamp->dev = st.st_dev;
+        stamp->ino = st.st_ino;
+        stamp->mtime_sec = st.st_mtim.tv_sec;
+        stamp->mtime_nsec = st.st_mtim.tv_nsec;
+    }
+    return true;
+}
+
+
+static bool path_stamps_match(const char *search, PyObject *stamps) {
+    const DirStamp *expected = (const DirStamp*) PyBytes_AS_STRING(stamps);
+    size_t count = PyBytes_GET_SIZE(stamps) / sizeof(DirStamp);
+    for (size_t index = 0; index < count; ++index) {
+        const char *end = strchrnul(search, ':');
+        DirStamp stamp;
+        if (!dir_stamp(search, end - search, &stamp) || (memcmp(&stamp, &expected[index], sizeof(stamp)) != 0)) {
+            return false;
+        }
+        search = *end ? end + 1 : end;
+    }
+    return true;
+}
+
+
+// resolves name like execvp() would, returns the path, None if it cannot be cached, or NULL
+static PyObject *path_resolve(ModuleState *state, const char *name) {
+    if (!*name || strchr(name, '/')) {
+        Py_RETURN_NONE;
+    }
+    const char *search = getenv("PATH");
+    if (!search) {
+        search = "/bin:/usr/bin";
+    }
+
+    PyObject *result = NULL;
+    PyObject *key = NULL;
+    PyObject *stamps = NULL;
+    DirStamp *stamp_list = NULL;
+    PyObject *path_cache = state->path_cache;
+
+    cache_lock(state);
+    key = Py_BuildValue("(NN)", PyBytes_FromString(name), PyBytes_FromString(search));
+    if (!key) {
+        goto end;
+    }
+    PyObject *cached = PyDict_GetItem(path_cache, key);
+    if (cached) {
+        if (path_stamps_match(search, PyTuple_GET_ITEM(cached, 1))) {
+            result = PyTuple_GET_ITEM(cached, 0);
+            Py_INCREF(result);
+            goto end;
+        }
+        if (PyDict_DelItem(path_cache, key) < 0) {
+            goto end;
+        }
+    }
+
+    size_t dir_count = 1;
+    for (const char *c = search; *c; ++c) {
+        dir_count += (*c == ':');
+    }
+    stamp_list = pymalloc(sizeof(DirStamp) * dir_count);
+    if (!stamp_list) {
+        PyErr_NoMemory();
+        goto end;
+    }
+
+    size_t name_length = strlen(name);
+    const char *dir = search;
+    for (size_t index = 0; index < dir_count; ++index) {
+        const char *end = strchrnul(dir, ':');
+        size_t length = end - dir;
+        char candidate[PATH_MAX];
+        if ((length == 0) || (dir[0] != '/') || (length + 1 + name_length >= sizeof(candidate))) {
+            // relative entries depend on the working directory
+            break;
+        }
+        if (!dir_stamp(dir, length, &stamp_list[index])) {
+            break;
+        }
+
+        memcpy(candidate, dir, length);
+        candidate[length] = '/';
+        memcpy(candidate + length + 1, name, name_length + 1);
+        struct stat st;
+        if ((stat(candidate, &st) == 0) && S_ISREG(st.st_mode) && (access(candidate, X_OK) == 0)) {
+            stamps = PyBytes_FromStringAndSize((const char*) stamp_list, sizeof(DirStamp) * (index + 1));
+            result = PyBytes_FromString(candidate);
+            if (!stamps || !result) {
+                Py_CLEAR(result);
+                goto end;
+            }
+            if (PyDict_Size(path_cache) >= PATH_CACHE_MAX) {
+                PyDict_Clear(path_cache);
+            }
+            PyObject *value = PyTuple_Pack(2, result, stamps);
+            if (!value || (PyDict_SetItem(path_cache, key, value) < 0)) {
+                Py_XDECREF(value);
+                Py_CLEAR(result);
+                goto end;
+            }
+            Py_DECREF(value);
+            goto end;
+        }
+
+        dir = *end ? end + 1 : end;
+    }
+
+    Py_INCREF(Py_None);
+    result = Py_None;
+
+  end:
+    cache_unlock(state);
+    pyfree(stamp_list);
+    Py_XDECREF(stamps);
+    Py_XDECREF(key);
+    return result;
+}
+
+
+static int path_converter(PyObject *input, PyObject **output) {
+#if PY_VERSION_HEX >= 0x03010000
+    return PyUnicode_FSConverter(input, output);
+#else
+    PyObject *result = as_bytes(input);
+    if (result) {
+        *output = result;
+        return true;
+    }
+    return false;
+#endif
+}
+
+
+static int bytes_list_converter(PyObject *obj, PyObject **list) {
+    if (!obj || (obj == Py_None)) {
+        *list = NULL;
+        return true;
+    }
+
+    PyObject *temp = object_as_list_of_bytes(obj);
+    *list = temp;
+    return temp != NULL;
+}
+
+
+static int bool_false_converter(PyObject *obj, bool *result) {
+    if (!obj || (obj == Py_None)) {
+        *result = false;
+    } else {
+        int value = PyObject_IsTrue(obj);
+        if (value < 0) {
+            return false;
+        }
+        *result = value != 0;
+    }
+    return true;
+}
+
+
+// like the "i" format unit
+static int int_converter(PyObject *obj, int *result) {
+    long value = PyLong_AsLong(obj);
+    if ((value == -1) && PyErr_Occurred()) {
+        return false;
+    } else if ((value < INT_MIN) || (value > INT_MAX)) {
+        PyErr_SetString(PyExc_OverflowError, "signed integer is out of range");
+        return false;
+    }
+    *result = (int) value;
+    return true;
+}
+
+
+/*
+ * A converter and its target, the pairs of "O&" as a table. The calls
+ * through another pointer type are the same PyArg_Parse*() makes.
+ */
+typedef int (*ArgConverter)(PyObject*, void*);
+typedef struct {
+    ArgConverter convert;
+    void *target;
+} ArgTarget;
+
+#define ARG_CONVERTER_ARGS(CONVERT, TARGET) CONVERT, TARGET
+#define ARG_CONVERTER_ENTRY(CONVERT, TARGET) { (ArgConverter) (CONVERT), (TARGET) }
+
+
+#ifdef HAVE_FASTCALL
+/*
+ * Parses METH_FASTCALL | METH_KEYWORDS arguments like Argument Clinic
+ * does. The names are interned once per module, so matching a keyword
+ * is mostly a pointer comparison.
+ */
+typedef struct {
+    const char *fname;
+    const char * const *keywords;
+    // all arguments, the first positional ones may be given by position
+    Py_ssize_t count;
+    Py_ssize_t positional;
+    Py_ssize_t required;
+} KeywordParser;
+
+
+static PyObject *keywords_intern(const KeywordParser *parser) {
+    PyObject *names = PyTuple_New(parser->count);
+    for (Py_ssize_t index = 0; names && (index < parser->count); ++index) {
+        PyObject *name = PyUnicode_InternFromString(parser->keywords[index]);
+        if (!name) {
+            Py_CLEAR(names);
+            break;
+        }
+        PyTuple_SET_ITEM(names, index, name);
+    }
+    return names;
+}
+
+
+// the index of name in names, -1 with or without an exception
+static Py_ssize_t keywords_find(PyObject *names, PyObject *name) {
+    Py_ssize_t count = PyTuple_GET_SIZE(names);
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        if (PyTuple_GET_ITEM(names, index) == name) {
+            return index;
+        }
+    }
+    // names built at runtime are not interned
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        int equal = PyObject_RichCompareBool(PyTuple_GET_ITEM(names, index), name, Py_EQ);
+        if (equal != 0) {
+            return (equal > 0) ? index : -1;
+        }
+    }
+    return -1;
+}
+
+
+// fills values with borrowed references, NULL if an argument was not given
+static bool keywords_unpack(
+    const KeywordParser *parser, PyObject *names,
+    PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames, PyObject **values
+) {
+    if (nargs > parser->positional) {
+        PyErr_Format(
+            PyExc_TypeError, "%s() takes at most %zd positional argument%s (%zd given)",
+            parser->fname, parser->positional, (parser->positional == 1) ? "" : "s", nargs
+        );
+        return false;
+    }
+    memcpy(values, args, sizeof(PyObject*) * nargs);
+    memset(values + nargs, 0, sizeof(PyObject*) * (parser->count - nargs));
+
+    Py_ssize_t kwcount = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+    for (Py_ssize_t kw = 0; kw < kwcount; ++kw) {
+        PyObject *name = PyTuple_GET_ITEM(kwnames, kw);
+        Py_ssize_t index = keywords_find(names, name);
+        if (index < 0) {
+            if (!PyErr_Occurred()) {
+                PyErr_Format(
+                    PyExc_TypeError, "'%U' is an invalid keyword argument for %s()",
+                    name, parser->fname
+                );
+            }
+            return false;
+        } else if (values[index]) {
+            PyErr_Format(
+                PyExc_TypeError, "argument for %s() given by name ('%s') and position (%zd)",
+                parser->fname, parser->keywords[index], index + 1
+            );
+            return false;
+        }
+        values[index] = args[nargs + kw];
+    }
+
+    for (Py_ssize_t index = nargs; index < parser->required; ++index) {
+        if (!values[index]) {
+            PyErr_Format(
+                PyExc_TypeError, "%s() missing required argument '%s' (pos %zd)",
+                parser->fname, parser->keywords[index], index + 1
+            );
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static bool arguments_convert(PyObject *const *values, const ArgTarget *targets, Py_ssize_t count) {
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        if (values[index] && !targets[index].convert(values[index], targets[index].target)) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+
+static int fd_converter(PyObject *obj, int *result) {
+    if (!obj || (obj == Py_None)) {
+        *result = -1;
+        return true;
+    }
+    int fd = PyObject_AsFileDescriptor(obj);
+    if (fd < 0) {
+        return false;
+    }
+    *result = fd;
+    return true;
+}
+
+
+typedef struct {
+    int fd;
+    bool owned;
+} CgroupFd;
+
+
+static int cgroup_converter(PyObject *obj, CgroupFd *result) {
+    result->fd = -1;
+    result->owned = false;
+    if (!obj || (obj == Py_None)) {
+        return true;
+    }
+    if (PyLong_Check(obj)) {
+        return fd_converter(obj, &result->fd);
+    }
+
+    PyObject *path = NULL;
+    if (!path_converter(obj, &path)) {
+        return false;
+    }
+    int fd = open(PyBytes_AS_STRING(path), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        return false;
+    }
+    Py_DECREF(path);
+    result->fd = fd;
+    result->owned = true;
+    return true;
+}
+
+
+typedef struct {
+    int *fds;
+    Py_ssize_t count;
+} FdList;
+
+
+static int fd_list_converter(PyObject *obj, FdList *result) {
+    result->fds = NULL;
+    result->count = 0;
+    if (!obj || (obj == Py_None)) {
+        return true;
+    }
+
+    PyObject *sequence = PySequence_Fast(obj, "pass_fds must be iterable");
+    if (!sequence) {
+        return false;
+    }
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+    int *fds = pymalloc(sizeof(int) * (count + 1));
+    if (!fds) {
+        Py_DECREF(sequence);
+        PyErr_NoMemory();
+        return false;
+    }
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        fds[index] = PyObject_AsFileDescriptor(PySequence_Fast_GET_ITEM(sequence, index));
+        if (fds[index] < 0) {
+            pyfree(fds);
+            Py_DECREF(sequence);
+            return false;
+        }
+    }
+    Py_DECREF(sequence);
+
+    result->fds = fds;
+    result->count = count;
+    return true;
+}
+
+
+static bool pylong_to_signum(PyObject *obj, int *result) {
+    long value;
+#if PY_MAJOR_VERSION >= 3
+    value = PyLong_AsLong(obj);
+#else
+    value = PyInt_AsLong(obj);
+#endif
+    if ((value < 0) || (value > _NSIG)) {
+        if (!((value == -1) || PyErr_Occurred())) {
+            PyErr_Format(
+                PyExc_OverflowError, "Signal number out of range: not (0 <= %zd <= %d)",
+                value, _NSIG
+            );
+        }
+        return false;
+    }
+    *result = (int) value;
+    return true;
+}
+
+
+static int signal_x_convert(PyObject *obj, int *result, int x) {
+    if (!obj || (obj == Py_None)) {
+        *result = x;
+        return true;
+    } else {
+        return pylong_to_signum(obj, result);
+    }
+}
+
+static int signal_0_convert(PyObject *obj, int *result) {
+    return signal_x_convert(obj, result, 0);
+}
+
+static int signal_m1_convert(PyObject *obj, int *result) {
+    return signal_x_convert(obj, result, -1);
+}
+
+
+typedef struct {
+    bool given;
+    int count;
+    sigset_t set;
+} SignalSet;
+
+
+#define CPU_MASK_WORDS (CPU_SETSIZE / (8 * sizeof(unsigned long)))
+#define NODE_MASK_WORDS (1024 / (8 * sizeof(unsigned long)))
+
+
+// sets the bits of an iterable of small non-negative ints
+static bool bit_mask_from_iterable(PyObject *obj, unsigned long *mask, size_t words, const char *what) {
+    size_t limit = words * 8 * sizeof(unsigned long);
+    memset(mask, 0, words * sizeof(unsigned long));
+
+    PyObject *iterator = PyObject_GetIter(obj);
+    if (!iterator) {
+        return false;
+    }
+    PyObject *elem;
+    while ((elem = PyIter_Next(iterator))) {
+        long index = PyLong_AsLong(elem);
+        Py_DECREF(elem);
+        if ((index == -1) && PyErr_Occurred()) {
+            break;
+        } else if ((index < 0) || ((size_t) index >= limit)) {
+            PyErr_Format(PyExc_ValueError, "Invalid %s number: %ld", what, index);
+            break;
+        }
+        mask[index / (8 * sizeof(unsigned long))] |= 1UL << (index % (8 * sizeof(unsigned long)));
+    }
+    Py_DECREF(iterator);
+    return !PyErr_Occurred();
+}
+
+
+typedef struct {
+    bool given;
+    unsigned long mask[CPU_MASK_WORDS];
+} CpuMask;
+
+
+static int cpu_mask_converter(PyObject *obj, CpuMask *result) {
+    result->given = false;
+    if (!obj || (obj == Py_None)) {
+        return true;
+    }
+    result->given = true;
+    return bit_mask_from_iterable(obj, result->mask, CPU_MASK_WORDS, "CPU");
+}
+
+
+typedef struct {
+    bool given;
+    int mode;
+    unsigned long nodes[NODE_MASK_WORDS];
+} NumaPolicy;
+
+
+static int numa_policy_converter(PyObject *obj, NumaPolicy *result) {
+    result->given = false;
+    if (!obj || (obj == Py_None)) {
+        return true;
+    }
+
+    PyObject *nodes = Py_None;
+    if (!PyArg_ParseTuple(obj, "i|O:numa_policy", &result->mode, &nodes)) {
+        return false;
+    }
+    result->given = true;
+    if (nodes == Py_None) {
+        memset(result->nodes, 0, sizeof(result->nodes));
+        return true;
+    }
+    return bit_mask_from_iterable(nodes, result->nodes, NODE_MASK_WORDS, "NUMA node");
+}
+
+
+typedef struct {
+    bool given;
+    int value;
+} OptionalInt;
+
+
+static int optional_int_converter(PyObject *obj, OptionalInt *result) {
+    result->given = false;
+    if (!obj || (obj == Py_None)) {
+        return true;
+    }
+    long value = PyLong_AsLong(obj);
+    if ((value == -1) && PyErr_Occurred()) {
+        return false;
+    } else if ((value < INT_MIN) || (value > INT_MAX)) {
+        PyErr_SetString(PyExc_OverflowError, "Value out of range");
+        return false;
+    }
+    result->given = true;
+    result->value = (int) value;
+    return true;
+}
+
+
+typedef struct {
+    unsigned given;
+    struct rlimit limits[RLIM_NLIMITS];
+} ResourceLimits;
+
+
+static bool rlim_from_pylong(PyObject *obj, rlim_t *result) {
+    long long value = PyLong_AsLongLong(obj);
+    if ((value == -1) && PyErr_Occurred()) {
+        return false;
+    } else if (value < -1) {
+        PyErr_Format(PyExc_ValueError, "Invalid resource limit: %lld", value);
+        return false;
+    }
+    *result = (value == -1) ? RLIM_INFINITY : (rlim_t) value;
+    return true;
+}
+
+
+static int rlimits_converter(PyObject *obj, ResourceLimits *result) {
+    result->given = 0;
+    if (!obj || (obj == Py_None)) {
+        return true;
+    }
+
+    PyObject *items = PyMapping_Items(obj);
+    if (!items) {
+        return false;
+    }
+    bool success = true;
+    for (Py_ssize_t index = 0; success && (index < PyList_GET_SIZE(items)); ++index) {
+        PyObject *item = PyList_GET_ITEM(items, index);
+        PyObject *limit = PyTuple_GET_ITEM(item, 1);
+        long resource = PyLong_AsLong(PyTuple_GET_ITEM(item, 0));
+        if ((resource == -1) && PyErr_Occurred()) {
+            success = false;
+            break;
+        } else if ((resource < 0) || (resource >= RLIM_NLIMITS)) {
+            PyErr_Format(PyExc_ValueError, "Invalid resource: %ld", resource);
+            success = false;
+            break;
+        }
+
+        struct rlimit *target = &result->limits[resource];
+        if (PyTuple_Check(limit)) {
+            PyObject *soft, *hard;
+            success = (
+                PyArg_ParseTuple(limit, "OO:rlimits", &soft, &hard) &&
+                rlim_from_pylong(soft, &target->rlim_cur) &&
+                rlim_from_pylong(hard, &target->rlim_max)
+            );
+        } else {
+            success = rlim_from_pylong(limit, &target->rlim_cur);
+            target->rlim_max = target->rlim_cur;
+        }
+        result->given |= 1U << resource;
+    }
+    Py_DECREF(items);
+    return success;
+}
+
+
+static int ioprio_converter(PyObject *obj, OptionalInt *result) {
+    if (obj && PyTuple_Check(obj)) {
+        int ioclass, level;
+        if (!PyArg_ParseTuple(obj, "ii:ioprio", &ioclass, &level)) {
+            return false;
+        } else if ((ioclass < 0) || (ioclass > 7) || (level < 0) || (level > 7)) {
+            PyErr_SetString(PyExc_ValueError, "Invalid I/O priority class or level");
+            return false;
+        }
+        result->given = true;
+        result->value = (ioclass << IOPRIO_CLASS_SHIFT) | level;
+        return true;
+    }
+    return optional_int_converter(obj, result);
+}
+
+
+#define ID_MAP_SIZE 128
+
+typedef struct {
+    char text[ID_MAP_SIZE];
+} IdMap;
+
+
+// text for /proc/<pid>/uid_map, empty if not given
+static int id_map_converter(PyObject *obj, IdMap *result) {
+    result->text[0] = '\0';
+    if (!obj || (obj == Py_None)) {
+        return true;
+    }
+
+    PyObject *text = NULL;
+    if (PyBytes_Check(obj) || PyUnicode_Check(obj)) {
+        text = as_bytes(obj);
+    } else {
+        PyObject *ranges = PySequence_Fast(obj, "uid_map and gid_map must be text or ranges");
+        if (!ranges) {
+            return false;
+        }
+        text = PyBytes_FromStringAndSize(NULL, 0);
+        for (Py_ssize_t index = 0; text && (index < PySequence_Fast_GET_SIZE(ranges)); ++index) {
+            unsigned long inside, outside, count;
+            PyObject *line = NULL;
+            // shared by uid_map and gid_map, so the message names both
+            if (PyArg_ParseTuple(
+                PySequence_Fast_GET_ITEM(ranges, index),
+                "kkk;uid_map and gid_map ranges must be (inside, outside, count)",
+                &inside, &outside, &count
+            )) {
+                line = PyBytes_FromFormat("%lu %lu %lu\n", inside, outside, count);
+            }
+            if (!line) {
+                Py_CLEAR(text);
+                break;
+            }
+            PyBytes_ConcatAndDel(&text, line);
+        }
+        Py_DECREF(ranges);
+    }
+    if (!text) {
+        return false;
+    }
+
+    bool success = false;
+    Py_ssize_t length = PyBytes_GET_SIZE(text);
+    if ((length == 0) || (length >= ID_MAP_SIZE)) {
+        PyErr_Format(PyExc_ValueError, "uid_map and gid_map must have 1 to %d bytes", ID_MAP_SIZE - 1);
+    } else if (memchr(PyBytes_AS_STRING(text), '\0', (size_t) length)) {
+        PyErr_SetString(PyExc_ValueError, "uid_map and gid_map must not contain NUL");
+    } else {
+        memcpy(result->text, PyBytes_AS_STRING(text), (size_t) length + 1);
+        success = true;
+    }
+    Py_DECREF(text);
+    return success;
+}
+
+
+static int signal_set_converter(PyObject *obj, SignalSet *result) {
+    sigemptyset(&result->set);
+    result->given = false;
+    result->count = 0;
+    if (!obj || (obj == Py_None)) {
+        return true;
+    }
+    result->given = true;
+
+#if PY_MAJOR_VERSION >= 3
+    if (PyLong_Check(obj)) {
+#else
+    if (PyInt_Check(obj) || PyLong_Check(obj)) {
+#endif
+        unsigned long long bits;
+#if PY_MAJOR_VERSION >= 3
+        bits = PyLong_AsUnsignedLongLong(obj);
+#else
+        bits = PyInt_AsUnsignedLongLongMask(obj);
+#endif
+        if ((bits == (unsigned long long) -1) && PyErr_Occurred()) {
+            return false;
+        }
+        for (int signum = 1; bits && (signum < _NSIG); ++signum, bits >>= 1) {
+            if (!(bits & 1)) {
+                continue;
+            } else if (sigaddset(&result->set, signum) != 0) {
+                // reserved by the libc, like in the iterable form
+                PyErr_Format(PyExc_ValueError, "Invalid signal number: %d", signum);
+                return false;
+            }
+            ++result->count;
+        }
+        return true;
+    }
+
+    bool success = false;
+    PyObject *iterator = PyObject_GetIter(obj);
+    if (!iterator) {
+        return false;
+    }
+    PyObject *(*iternext)(PyObject *) = *Py_TYPE(iterator)->tp_iternext;
+    for (;;) {
+        PyObject *elem = iternext(iterator);
+        if (!elem) {
+            if (PyErr_Occurred()) {
+                if (!PyErr_ExceptionMatches(PyExc_StopIteration)) {
+                    success = false;
+                    break;
+                }
+                PyErr_Clear();
+            }
+            success = true;
+            break;
+        }
+
+        int signum;
+        success = pylong_to_signum(elem, &signum);
+        Py_DECREF(elem);
+        if (!success) {
+            break;
+        }
+        if (signum > 0) {
+            if (sigaddset(&result->set, signum) != 0) {
+                PyErr_Format(PyExc_ValueError, "Invalid signal number: %d", signum);
+                success = false;
+                break;
+            }
+            ++result->count;
+        }
+    }
+
+    Py_DECREF(iterator);
+    return success;
+}
+
+
+enum {
+    BACKEND_CLONE,
+    BACKEND_CLONE3,
+    BACKEND_POSIX_SPAWN,
+    BACKEND_COUNT,
+};
+
+static const char *backend_names[] = { "clone", "clone3", "posix_spawn" };
+
+
+// -1 lets spawn_options_apply() pick the backend
+static int backend_converter(PyObject *obj, int *result) {
+    if (!obj || (obj == Py_None)) {
+        *result = -1;
+        return true;
+    }
+
+    PyObject *bytes = as_bytes(obj);
+    if (!bytes) {
+        return false;
+    }
+    const char *name = PyBytes_AS_STRING(bytes);
+    for (int backend = 0; backend < BACKEND_COUNT; ++backend) {
+        if (strcmp(name, backend_names[backend]) == 0) {
+            Py_DECREF(bytes);
+            *result = backend;
+            return true;
+        }
+    }
+    PyErr_Format(PyExc_ValueError, "Unknown backend: %s", name);
+    Py_DECREF(bytes);
+    return false;
+}
+
+
+static PyObject *getpdeathsignal_impl(PyObject *self, PyObject *no_args) {
+    (void) self;
+    (void) no_args;
+
+    int signal = -1;
+    int outcome = prctl(
+        PR_GET_PDEATHSIG,
+        (unsigned long) (uintptr_t) &signal,
+        0, 0, 0
+    );
+    return int_or_errno(outcome == 0, signal);
+}
+
+
+#ifdef HAVE_FASTCALL
+static const KeywordParser setpdeathsignal_parser = {
+    "setpdeathsignal", setpdeathsignal_keywords, 1, 1, 0,
+};
+#endif
+
+
+static PyObject *setpdeathsignal_impl(PyObject *self, FASTCALL_PARAMETERS) {
+    int signal = 0;
+#ifdef HAVE_FASTCALL
+    PyObject *value = NULL;
+    if ((nargs == 1) && !kwnames) {
+        value = args[0];
+    } else if ((nargs != 0) || kwnames) {
+        PyObject *names = module_state(self)->setpdeathsignal_kwnames;
+        if (!keywords_unpack(&setpdeathsignal_parser, names, args, nargs, kwnames, &value)) {
+            return NULL;
+        }
+    }
+    if (value && !signal_0_convert(value, &signal)) {
+        return NULL;
+    }
+#else
+    (void) self;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O&:setpdeathsignal",
+        (char**) setpdeathsignal_keywords,
+        signal_0_convert, &signal
+    )) {
+        return NULL;
+    }
+#endif
+
+    int outcome = prctl(
+        PR_SET_PDEATHSIG,
+        signal,
+        0, 0, 0
+    );
+    if (outcome == 0) {
+        Py_RETURN_NONE;
+    } else {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+}
+
+
+// serializes the one-time setups, it is only held around C code
+static pthread_mutex_t setup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+
+
+static void setup_atfork_child(void) {
+    pthread_mutex_init(&setup_lock, NULL);
+}
+
+
+static void setup_init(void) {
+    pthread_atfork(NULL, NULL, setup_atfork_child);
+}
+
+
+static int at_fork_signal = 0;
+static bool at_fork_registered = false;
+// snapshot of the prepare handler for the child handler, per thread since the
+// forking thread is the one that continues in the child
+static __thread pid_t at_fork_parent = 0;
+static __thread int at_fork_child_signal = 0;
+
+
+static void at_fork_prepare(void) {
+    at_fork_child_signal = __atomic_load_n(&at_fork_signal, __ATOMIC_RELAXED);
+    at_fork_parent = getpid();
+}
+
+
+static void at_fork_child(void) {
+    // a register_at_fork() between prepare and fork() must not pair a signal with no parent
+    int signal = at_fork_child_signal;
+    if (!signal) {
+        return;
+    }
+    int error = errno;
+    if ((prctl(PR_SET_PDEATHSIG, signal, 0, 0, 0) == 0) && (getppid() != at_fork_parent)) {
+        // the parent died before the death signal was set
+        kill(getpid(), signal);
+    }
+    errno = error;
+}
+
+
+static PyObject *register_at_fork_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+
+    int signal = 0;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O&:register_at_fork",
+        (char**) setpdeathsignal_keywords,
+        signal_0_convert, &signal
+    )) {
+        return NULL;
+    }
+    if ((signal < 0) || (signal >= NSIG)) {
+        PyErr_SetString(PyExc_ValueError, "signal number out of range");
+        return NULL;
+    }
+
+    if (signal) {
+        int error = 0;
+        pthread_mutex_lock(&setup_lock);
+        if (!at_fork_registered) {
+            error = pthread_atfork(at_fork_prepare, NULL, at_fork_child);
+            at_fork_registered = error == 0;
+        }
+        pthread_mutex_unlock(&setup_lock);
+        if (error != 0) {
+            errno = error;
+            return PyErr_SetFromErrno(PyExc_OSError);
+        }
+    }
+    int previous = __atomic_exchange_n(&at_fork_signal, signal, __ATOMIC_RELAXED);
+    return PyLong_FromLong(previous);
+}
+
+
+// the namespaces that clone() and clone3() can create
+#ifndef CLONE_NEWCGROUP
+#   define CLONE_NEWCGROUP 0x02000000
+#endif
+#define CLONE_NAMESPACES ( \
+    CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWUSER | \
+    CLONE_NEWPID | CLONE_NEWNET | CLONE_NEWCGROUP \
+)
+
+
+enum {
+    ETD_SEARCH_PATH,
+    ETD_SETSID,
+    ETD_DOUBLEFORK,
+    ETD_SIBLING,
+    ETD_PIDFD,
+    ETD_SIGIGN,
+    ETD_SIGDEFAULT,
+    ETD_SIGMASK,
+    ETD_CLOSE_FDS,
+    ETD_STATS,
+    ETD_SETPGID,
+    ETD_CPU_AFFINITY,
+    ETD_SCHED,
+    ETD_NICE,
+    ETD_NUMA,
+    ETD_RLIMITS,
+    ETD_IOPRIO,
+    ETD_OOM_SCORE_ADJ,
+};
+
+typedef struct {
+    char *path;
+    char *resolved;
+    char **argv;
+    char **envp;
+    unsigned flags;
+    int backend;
+    int parent_signal;
+    pid_t pgid;
+    int cgroup;
+    unsigned long cpu_affinity[CPU_MASK_WORDS];
+    int sched_policy;
+    int sched_priority;
+    int nice;
+    int numa_mode;
+    unsigned long numa_nodes[NODE_MASK_WORDS];
+    unsigned rlimits_given;
+    struct rlimit rlimits[RLIM_NLIMITS];
+    int ioprio;
+    int oom_score_adj;
+    int namespaces;
+    char uid_map[ID_MAP_SIZE];
+    char gid_map[ID_MAP_SIZE];
+    sigset_t sigign;
+    sigset_t sigdefault;
+    sigset_t sigmask;
+    int stdio[3];
+    const int *pass_fds;
+    Py_ssize_t pass_fds_count;
+    int childpid;
+    int pidfd;
+    char *fun;
+    // the step the spawn helper reported, fun points here
+    char helper_fun[32];
+    int error;
+    // top of the grandchild's stack for doublefork
+    char *doublefork_stack;
+    uint64_t stats_prepare;
+    uint64_t stats_child_started;
+    uint64_t stats_child_exec;
+} ExecTrampolineData;
+
+
+enum {
+    STATS_PREPARE,
+    STATS_CLONE,
+    STATS_CHILD,
+    STATS_EXEC,
+    STATS_SPAWN,
+    STATS_WAIT,
+    STATS_PHASE_COUNT,
+};
+
+static const char *stats_phase_names[STATS_PHASE_COUNT] = {
+    "prepare", "clone", "child", "exec", "spawn", "wait",
+};
+
+#define STATS_BUCKETS 40
+#define STATS_FUNS 16
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t buckets[STATS_BUCKETS];
+} StatsPhase;
+
+// updated without the GIL, all accesses are relaxed atomics
+static struct {
+    uint64_t spawns;
+    uint64_t failures;
+    const char *funs[STATS_FUNS];
+    uint64_t fun_failures[STATS_FUNS];
+    StatsPhase phases[STATS_PHASE_COUNT];
+} spawn_stats;
+
+static bool spawn_stats_enabled = false;
+
+
+static uint64_t stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+
+static uint64_t stats_started(void) {
+    return __atomic_load_n(&spawn_stats_enabled, __ATOMIC_RELAXED) ? stats_now() : 0;
+}
+
+
+static void stats_add(int phase, uint64_t begin, uint64_t end) {
+    if (!begin || !end || (end < begin)) {
+        return;
+    }
+    uint64_t duration = end - begin;
+    int bucket = duration ? (64 - __builtin_clzll(duration)) : 0;
+    if (bucket >= STATS_BUCKETS) {
+        bucket = STATS_BUCKETS - 1;
+    }
+
+    StatsPhase *stats = &spawn_stats.phases[phase];
+    __atomic_fetch_add(&stats->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->total, duration, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->buckets[bucket], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&stats->max, __ATOMIC_RELAXED);
+    while ((duration > max) && !__atomic_compare_exchange_n(
+        &stats->max, &max, duration, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+    )) {
+    }
+}
+
+
+static void stats_add_failure(const char *fun) {
+    __atomic_fetch_add(&spawn_stats.failures, 1, __ATOMIC_RELAXED);
+    for (int index = 0; index < STATS_FUNS; ++index) {
+        const char *slot = __atomic_load_n(&spawn_stats.funs[index], __ATOMIC_ACQUIRE);
+        if (!slot) {
+            const char *expected = NULL;
+            if (__atomic_compare_exchange_n(
+                &spawn_stats.funs[index], &expected, fun, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE
+            )) {
+                slot = fun;
+            } else {
+                slot = expected;
+            }
+        }
+        if ((slot == fun) || (strcmp(slot, fun) == 0)) {
+            __atomic_fetch_add(&spawn_stats.fun_failures[index], 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    // more distinct failing functions than slots, only counted in total
+}
+
+
+/*
+ * Spawn times for reap(), indexed by pid. A slot packs the pid (less
+ * than 2**22, PID_MAX_LIMIT) with the CLOCK_MONOTONIC microseconds
+ * modulo 2**42, so durations up to 50 days are exact. Colliding pids
+ * overwrite each other, the older child's duration is unknown then.
+ */
+#define SPAWN_TIMES 16384
+#define SPAWN_TIME_BITS 42
+#define SPAWN_TIME_MASK ((UINT64_C(1) << SPAWN_TIME_BITS) - 1)
+
+static uint64_t spawn_times[SPAWN_TIMES];
+
+
+static uint64_t spawn_time_now(void) {
+    return (stats_now() / 1000) & SPAWN_TIME_MASK;
+}
+
+
+static void spawn_time_record(pid_t pid) {
+    if ((pid > 0) && (pid < (1 << 22))) {
+        uint64_t entry = ((uint64_t) pid << SPAWN_TIME_BITS) | spawn_time_now();
+        __atomic_store_n(&spawn_times[pid % SPAWN_TIMES], entry, __ATOMIC_RELAXED);
+    }
+}
+
+
+// the microseconds since the spawn of pid, -1 if unknown; the slot is freed
+static int64_t spawn_time_take(pid_t pid, uint64_t now) {
+    if ((pid <= 0) || (pid >= (1 << 22))) {
+        return -1;
+    }
+    uint64_t *slot = &spawn_times[pid % SPAWN_TIMES];
+    uint64_t entry = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    if (
+        ((entry >> SPAWN_TIME_BITS) != (uint64_t) pid) ||
+        !__atomic_compare_exchange_n(slot, &entry, 0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+    ) {
+        return -1;
+    }
+    return (int64_t) ((now - entry) & SPAWN_TIME_MASK);
+}
+
+
+typedef struct {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+} CloneArgs;
+
+
+static bool signals_set_handler(const sigset_t *signals, sighandler_t handler) {
+    for (int signum = 1; signum < _NSIG; ++signum) {
+        if ((signum == SIGKILL) || (signum == SIGSTOP) || (sigismember(signals, signum) != 1)) {
+            continue;
+        }
+        if (signal(signum, handler) == SIG_ERR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+#define CLOSE_FDS_FALLBACK_MAX (1 << 16)
+
+static bool trampoline_fds(const ExecTrampolineData *data, char **fun) {
+    int stdio[3] = { data->stdio[0], data->stdio[1], data->stdio[2] };
+    for (int target = 0; target < 3; ++target) {
+        if ((stdio[target] >= 0) && (stdio[target] < 3) && (stdio[target] != target)) {
+            // an earlier dup2() could overwrite the source
+            stdio[target] = fcntl(stdio[target], F_DUPFD_CLOEXEC, 3);
+            if (stdio[target] < 0) {
+                *fun = "fcntl(F_DUPFD_CLOEXEC)";
+                return false;
+            }
+        }
+    }
+    for (int target = 0; target < 3; ++target) {
+        if (stdio[target] < 0) {
+            continue;
+        } else if (stdio[target] == target) {
+            if (fcntl(target, F_SETFD, 0) != 0) {
+                *fun = "fcntl(F_SETFD)";
+                return false;
+            }
+        } else if (dup2(stdio[target], target) < 0) {
+            *fun = "dup2";
+            return false;
+        }
+    }
+
+    if (data->flags & (1 << ETD_CLOSE_FDS)) {
+        if (syscall(SYS_close_range, 3, ~0U, CLOSE_RANGE_CLOEXEC) != 0) {
+            // kernel older than 5.11
+            long max_fd = sysconf(_SC_OPEN_MAX);
+            if ((max_fd < 0) || (max_fd > CLOSE_FDS_FALLBACK_MAX)) {
+                max_fd = CLOSE_FDS_FALLBACK_MAX;
+            }
+            for (int fd = 3; fd < max_fd; ++fd) {
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+            }
+        }
+    }
+
+    for (Py_ssize_t index = 0; index < data->pass_fds_count; ++index) {
+        if (fcntl(data->pass_fds[index], F_SETFD, 0) != 0) {
+            *fun = "fcntl(F_SETFD)";
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static bool trampoline_sched(const ExecTrampolineData *data, char **fun) {
+    if (data->flags & (1 << ETD_CPU_AFFINITY)) {
+        if (sched_setaffinity(0, sizeof(data->cpu_affinity), (const cpu_set_t*) data->cpu_affinity) != 0) {
+            *fun = "sched_setaffinity";
+            return false;
+        }
+    }
+    if (data->flags & (1 << ETD_NUMA)) {
+        // maxnode counts bits, the kernel ignores the last one
+        unsigned long maxnode = 8 * sizeof(data->numa_nodes) + 1;
+        const unsigned long *nodes = data->numa_nodes;
+        if ((data->numa_mode == MPOL_DEFAULT) || (data->numa_mode == MPOL_LOCAL)) {
+            nodes = NULL;
+            maxnode = 0;
+        }
+        if (syscall(SYS_set_mempolicy, data->numa_mode, nodes, maxnode) != 0) {
+            *fun = "set_mempolicy";
+            return false;
+        }
+    }
+    if (data->flags & (1 << ETD_SCHED)) {
+        struct sched_param param = { .sched_priority = data->sched_priority };
+        if (sched_setscheduler(0, data->sched_policy, &param) != 0) {
+            *fun = "sched_setscheduler";
+            return false;
+        }
+    }
+    if (data->flags & (1 << ETD_NICE)) {
+        if (setpriority(PRIO_PROCESS, 0, data->nice) != 0) {
+            *fun = "setpriority";
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static bool trampoline_limits(const ExecTrampolineData *data, char **fun) {
+    if (data->flags & (1 << ETD_OOM_SCORE_ADJ)) {
+        // no stdio in the trampoline, format by hand
+        char buffer[16];
+        char *end = buffer + sizeof(buffer);
+        char *start = end;
+        int value = data->oom_score_adj;
+        unsigned magnitude = (value < 0) ? -(unsigned) value : (unsigned) value;
+        do {
+            *--start = '0' + (magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude);
+        if (value < 0) {
+            *--start = '-';
+        }
+
+        int fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+        if (fd < 0) {
+            *fun = "open(oom_score_adj)";
+            return false;
+        }
+        ssize_t written = write(fd, start, end - start);
+        int error = errno;
+        close(fd);
+        if (written != end - start) {
+            errno = error;
+            *fun = "write(oom_score_adj)";
+            return false;
+        }
+    }
+    if (data->flags & (1 << ETD_IOPRIO)) {
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, data->ioprio) != 0) {
+            *fun = "ioprio_set";
+            return false;
+        }
+    }
+    if (data->flags & (1 << ETD_RLIMITS)) {
+        for (int resource = 0; resource < RLIM_NLIMITS; ++resource) {
+            if ((data->rlimits_given & (1U << resource)) && (setrlimit(resource, &data->rlimits[resource]) != 0)) {
+                *fun = "setrlimit";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+static bool trampoline_write_file(const char *path, const char *text, char **fun, char *failed) {
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *fun = failed;
+        return false;
+    }
+    size_t length = strlen(text);
+    ssize_t written = write(fd, text, length);
+    int error = errno;
+    close(fd);
+    if (written != (ssize_t) length) {
+        errno = error;
+        *fun = failed;
+        return false;
+    }
+    return true;
+}
+
+
+static bool trampoline_id_maps(const ExecTrampolineData *data, char **fun) {
+    if (data->uid_map[0] && !trampoline_write_file("/proc/self/uid_map", data->uid_map, fun, "write(uid_map)")) {
+        return false;
+    }
+    if (data->gid_map[0]) {
+        // unprivileged writers must give up setgroups() first
+        if (
+            !trampoline_write_file("/proc/self/setgroups", "deny", fun, "write(setgroups)") &&
+            (errno != ENOENT)
+        ) {
+            return false;
+        }
+        if (!trampoline_write_file("/proc/self/gid_map", data->gid_map, fun, "write(gid_map)")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static int exec_trampoline(void *arg) {
+    ExecTrampolineData *data = (ExecTrampolineData*) arg;
+    char *fun = NULL;
+
+    if ((data->flags & (1 << ETD_STATS)) && !data->stats_child_started) {
+        data->stats_child_started = stats_now();
+    }
+
+    if (data->flags & (1 << ETD_SETSID)) {
+        data->flags &= ~(1 << ETD_SETSID);
+        pid_t outcome = setsid();
+        if (outcome == (pid_t) -1) {
+            fun = "setsid";
+            goto fail;
+        }
+    }
+
+    int parent_signal = data->parent_signal;
+    if (parent_signal >= 0) {
+        data->parent_signal = 0;
+        int outcome = prctl(PR_SET_PDEATHSIG, parent_signal, 0, 0, 0);
+        if (outcome != 0) {
+            fun = "PR_SET_PDEATHSIG";
+            goto fail;
+        }
+    }
+
+    if (data->flags & (1 << ETD_DOUBLEFORK)) {
+        data->flags &= ~(1 << ETD_DOUBLEFORK);
+        // a new PID namespace would die with its init, this child
+        int flags = CLONE_VFORK | CLONE_VM | data->namespaces;
+        if (data->flags & (1 << ETD_PIDFD)) {
+            // this child shares the caller's descriptor table
+            flags |= CLONE_PIDFD;
+        }
+        int childprocess = clone(exec_trampoline, data->doublefork_stack, flags, data, &data->pidfd);
+        if (childprocess < 0) {
+            fun = "clone(doublefork)";
+            goto fail;
+        }
+        // the grandchild has exec'd or reported its error in data
+        data->childpid = childprocess;
+        _exit(0);
+    }
+
+    if (!trampoline_id_maps(data, &fun)) {
+        goto fail;
+    }
+
+    if (data->flags & (1 << ETD_SETPGID)) {
+        data->flags &= ~(1 << ETD_SETPGID);
+        if (setpgid(0, data->pgid) != 0) {
+            fun = "setpgid";
+            goto fail;
+        }
+    }
+
+    if (!trampoline_sched(data, &fun)) {
+        goto fail;
+    }
+
+    if (data->flags & (1 << ETD_SIGDEFAULT)) {
+        data->flags &= ~(1 << ETD_SIGDEFAULT);
+        if (!signals_set_handler(&data->sigdefault, SIG_DFL)) {
+            fun = "signal";
+            goto fail;
+        }
+    }
+
+    if (data->flags & (1 << ETD_SIGIGN)) {
+        data->flags &= ~(1 << ETD_SIGIGN);
+        if (!signals_set_handler(&data->sigign, SIG_IGN)) {
+            fun = "signal";
+            goto fail;
+        }
+    }
+
+    if (data->flags & (1 << ETD_SIGMASK)) {
+        data->flags &= ~(1 << ETD_SIGMASK);
+        if (sigprocmask(SIG_SETMASK, &data->sigmask, NULL) != 0) {
+            fun = "sigprocmask";
+            goto fail;
+        }
+    }
+
+    if (!trampoline_fds(data, &fun)) {
+        goto fail;
+    }
+    // after the descriptors, a low RLIMIT_NOFILE would break the dup2()s
+    if (!trampoline_limits(data, &fun)) {
+        goto fail;
+    }
+
+    data->childpid = getpid();
+    if (data->flags & (1 << ETD_STATS)) {
+        data->stats_child_exec = stats_now();
+    }
+
+    if (data->resolved) {
+        if (data->envp) {
+            execve(data->resolved, data->argv, data->envp);
+        } else {
+            execv(data->resolved, data->argv);
+        }
+        // stale cache entry, fall back to searching $PATH
+    }
+
+    if (data->envp) {
+        if (data->flags & (1 << ETD_SEARCH_PATH)) {
+            execvpe(data->path,  data->argv, data->envp);
+            fun = "execvpe";
+        } else {
+            execve(data->path, data->argv, data->envp);
+            fun = "execve";
+        }
+    } else {
+        if (data->flags & (1 << ETD_SEARCH_PATH)) {
+            execvp(data->path, data->argv);
+            fun = "execvp";
+        } else {
+            execv(data->path, data->argv);
+            fun = "execv";
+        }
+    }
+
+  fail:
+    // visible to the caller before it resumes, the vfork suspension orders it
+    data->fun = fun;
+    data->error = errno;
+    _exit(127);
+    return -1;
+}
+
+
+#ifdef HAVE_CLONE3_TRAMPOLINE
+/*
+ * glibc does not export a clone3() wrapper. The child starts on the new
+ * stack, so it must call fn() without returning from this function.
+ */
+static long clone3_call(CloneArgs *args, int (*fn)(void *), void *arg) {
+    long result;
+    register int (*r12)(void *) __asm__("r12") = fn;
+    register void *r13 __asm__("r13") = arg;
+    __asm__ volatile(
+        "syscall\n\t"
+        "test %%rax, %%rax\n\t"
+        "jnz 1f\n\t"
+        "xor %%ebp, %%ebp\n\t"
+        "mov %%r13, %%rdi\n\t"
+        "call *%%r12\n\t"
+        "mov %%eax, %%edi\n\t"
+        "mov %[sys_exit], %%eax\n\t"
+        "syscall\n\t"
+        "hlt\n\t"
+        "1:\n\t"
+        : "=a" (result)
+        : "0" ((long) SYS_clone3), "D" (args), "S" (sizeof(*args)),
+          "r" (r12), "r" (r13), [sys_exit] "i" (SYS_exit)
+        : "rcx", "r11", "memory", "cc"
+    );
+    if (result < 0) {
+        errno = (int) -result;
+        return -1;
+    }
+    return result;
+}
+#endif
+
+
+static bool clone3_supported(void) {
+#ifdef HAVE_CLONE3_TRAMPOLINE
+    static int supported = -1;
+    if (supported < 0) {
+        // an empty argument struct is rejected with EINVAL if clone3 exists
+        long outcome = syscall(SYS_clone3, NULL, 0);
+        supported = (outcome < 0) && (errno != ENOSYS);
+    }
+    return supported;
+#else
+    return false;
+#endif
+}
+
+
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#   if __GLIBC_PREREQ(2, 34)
+#       define HAVE_POSIX_SPAWN_CLOSEFROM 1
+#   endif
+#endif
+
+static int posix_spawn_fds(const ExecTrampolineData *data, posix_spawn_file_actions_t *actions) {
+    int error = 0;
+    for (int target = 0; (error == 0) && (target < 3); ++target) {
+        if (data->stdio[target] >= 0) {
+            // a dup2 onto itself clears close-on-exec
+            error = posix_spawn_file_actions_adddup2(actions, data->stdio[target], target);
+        }
+    }
+    for (Py_ssize_t index = 0; (error == 0) && (index < data->pass_fds_count); ++index) {
+        // a dup2 onto itself clears close-on-exec
+        error = posix_spawn_file_actions_adddup2(actions, data->pass_fds[index], data->pass_fds[index]);
+    }
+#ifdef HAVE_POSIX_SPAWN_CLOSEFROM
+    if ((error == 0) && (data->flags & (1 << ETD_CLOSE_FDS))) {
+        error = posix_spawn_file_actions_addclosefrom_np(actions, 3);
+    }
+#endif
+    return error;
+}
+
+
+static int posix_spawn_run(ExecTrampolineData *data) {
+    posix_spawnattr_t attr;
+    int error = posix_spawnattr_init(&attr);
+    if (error != 0) {
+        data->error = error;
+        return -1;
+    }
+
+    short spawn_flags = 0;
+#ifdef POSIX_SPAWN_SETSID
+    if (data->flags & (1 << ETD_SETSID)) {
+        spawn_flags |= POSIX_SPAWN_SETSID;
+    }
+#endif
+    if ((error == 0) && (data->flags & (1 << ETD_SETPGID))) {
+        spawn_flags |= POSIX_SPAWN_SETPGROUP;
+        error = posix_spawnattr_setpgroup(&attr, data->pgid);
+    }
+    if ((error == 0) && (data->flags & (1 << ETD_SCHED))) {
+        struct sched_param param = { .sched_priority = data->sched_priority };
+        spawn_flags |= POSIX_SPAWN_SETSCHEDULER;
+        error = posix_spawnattr_setschedpolicy(&attr, data->sched_policy);
+        if (error == 0) {
+            error = posix_spawnattr_setschedparam(&attr, &param);
+        }
+    }
+    if (data->flags & (1 << ETD_SIGDEFAULT)) {
+        spawn_flags |= POSIX_SPAWN_SETSIGDEF;
+        posix_spawnattr_setsigdefault(&attr, &data->sigdefault);
+    }
+    if (data->flags & (1 << ETD_SIGMASK)) {
+        spawn_flags |= POSIX_SPAWN_SETSIGMASK;
+        posix_spawnattr_setsigmask(&attr, &data->sigmask);
+    }
+    if ((error == 0) && spawn_flags) {
+        error = posix_spawnattr_setflags(&attr, spawn_flags);
+    }
+
+    posix_spawn_file_actions_t actions;
+    int actions_error = posix_spawn_file_actions_init(&actions);
+    if ((error == 0) && (actions_error != 0)) {
+        error = actions_error;
+    }
+    if (error == 0) {
+        error = posix_spawn_fds(data, &actions);
+    }
+
+    pid_t childprocess = -1;
+    if (error == 0) {
+        char **envp = data->envp ? data->envp : environ;
+        if (data->resolved) {
+            error = posix_spawn(&childprocess, data->resolved, &actions, &attr, data->argv, envp);
+            if (error != 0) {
+                // stale cache entry
+                error = posix_spawnp(&childprocess, data->path, &actions, &attr, data->argv, envp);
+            }
+        } else if (data->flags & (1 << ETD_SEARCH_PATH)) {
+            error = posix_spawnp(&childprocess, data->path, &actions, &attr, data->argv, envp);
+        } else {
+            error = posix_spawn(&childprocess, data->path, &actions, &attr, data->argv, envp);
+        }
+    }
+    if (actions_error == 0) {
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    posix_spawnattr_destroy(&attr);
+
+    if (error != 0) {
+        data->error = error;
+        return -1;
+    }
+    data->childpid = childprocess;
+    return childprocess;
+}
+
+
+static bool backend_check(int backend, const ExecTrampolineData *data) {
+    if ((data->cgroup >= 0) && (backend != BACKEND_CLONE3)) {
+        PyErr_SetString(PyExc_ValueError, "Only the clone3 backend can spawn into a cgroup");
+        return false;
+    }
+
+    switch (backend) {
+    case BACKEND_CLONE:
+        return true;
+
+    case BACKEND_CLONE3:
+        if (!clone3_supported()) {
+            PyErr_SetString(PyExc_ValueError, "The clone3 backend is not supported on this system");
+            return false;
+        }
+        return true;
+
+    case BACKEND_POSIX_SPAWN:
+        if (
+            (data->parent_signal > 0) ||
+            (data->flags & ((1 << ETD_SIBLING) | (1 << ETD_DOUBLEFORK) | (1 << ETD_SIGIGN)))
+#ifndef POSIX_SPAWN_SETSID
+            || (data->flags & (1 << ETD_SETSID))
+#endif
+        ) {
+            PyErr_SetString(
+                PyExc_ValueError,
+                "The posix_spawn backend cannot express signal, sibling, doublefork or sigign"
+            );
+            return false;
+        }
+        if (data->flags & (
+            (1 << ETD_CPU_AFFINITY) | (1 << ETD_NICE) | (1 << ETD_NUMA) |
+            (1 << ETD_RLIMITS) | (1 << ETD_IOPRIO) | (1 << ETD_OOM_SCORE_ADJ)
+        )) {
+            PyErr_SetString(
+                PyExc_ValueError,
+                "The posix_spawn backend cannot express cpu_affinity, nice, numa_policy, "
+                "rlimits, ioprio or oom_score_adj"
+            );
+            return false;
+        }
+        if (data->namespaces) {
+            PyErr_SetString(PyExc_ValueError, "The posix_spawn backend cannot express namespaces");
+            return false;
+        }
+#ifdef HAVE_POSIX_SPAWN_CLOSEFROM
+        if ((data->flags & (1 << ETD_CLOSE_FDS)) && (data->pass_fds_count > 0))
+#else
+        if (data->flags & (1 << ETD_CLOSE_FDS))
+#endif
+        {
+            PyErr_SetString(
+                PyExc_ValueError,
+                "The posix_spawn backend cannot express close_fds together with pass_fds"
+            );
+            return false;
+        }
+        for (int target = 0; target < 3; ++target) {
+            int source = data->stdio[target];
+            if ((source >= 0) && (source < target) && (data->stdio[source] >= 0) && (data->stdio[source] != source)) {
+                // the file actions would see the already redirected descriptor
+                PyErr_SetString(
+                    PyExc_ValueError,
+                    "The posix_spawn backend cannot redirect stdio to a redirected stdio descriptor"
+                );
+                return false;
+            }
+        }
+        return true;
+
+    default:
+        PyErr_SetString(PyExc_ValueError, "Unknown backend");
+        return false;
+    }
+}
+
+
+typedef struct {
+    int signal;
+    bool sibling;
+    bool search_path;
+    bool setsid;
+    bool doublefork;
+    SignalSet sigign;
+    int backend;
+    bool pidfd;
+    PyObject *env_update;
+    SignalSet sigmask;
+    SignalSet sigdefault;
+    int stdin_fd;
+    int stdout_fd;
+    int stderr_fd;
+    FdList pass_fds;
+    bool close_fds;
+    CgroupFd cgroup;
+    CpuMask cpu_affinity;
+    OptionalInt sched_policy;
+    OptionalInt priority;
+    OptionalInt nice;
+    NumaPolicy numa_policy;
+    ResourceLimits rlimits;
+    OptionalInt ioprio;
+    OptionalInt oom_score_adj;
+    int namespaces;
+    IdMap uid_map;
+    IdMap gid_map;
+} SpawnOptions;
+
+// must match SPAWN_OPTIONS_KEYWORDS
+#define SPAWN_OPTIONS_FORMAT \
+    "O&" "O&" "O&" "O&" "O&" "O&" "O&" "O&" "O&" "O&" "O&" \
+    "O&" "O&" "O&" "O&" "O&" "O&" \
+    "O&" "O&" "O&" "O&" "O&" \
+    "O&" "O&" "O&" \
+    "O&" "O&" "O&"
+#define SPAWN_OPTIONS_COUNT 28
+#define SPAWN_OPTIONS_CONVERTERS(OPTIONS) SPAWN_OPTIONS_CONVERTERS_WITH(ARG_CONVERTER_ARGS, OPTIONS)
+// X(converter, target) for every option
+#define SPAWN_OPTIONS_CONVERTERS_WITH(X, OPTIONS) \
+    X(signal_m1_convert, &(OPTIONS)->signal), \
+    X(bool_false_converter, &(OPTIONS)->sibling), \
+    X(bool_false_converter, &(OPTIONS)->search_path), \
+    X(bool_false_converter, &(OPTIONS)->setsid), \
+    X(bool_false_converter, &(OPTIONS)->doublefork), \
+    X(signal_set_converter, &(OPTIONS)->sigign), \
+    X(backend_converter, &(OPTIONS)->backend), \
+    X(bool_false_converter, &(OPTIONS)->pidfd), \
+    X(env_update_converter, &(OPTIONS)->env_update), \
+    X(signal_set_converter, &(OPTIONS)->sigmask), \
+    X(signal_set_converter, &(OPTIONS)->sigdefault), \
+    X(fd_converter, &(OPTIONS)->stdin_fd), \
+    X(fd_converter, &(OPTIONS)->stdout_fd), \
+    X(fd_converter, &(OPTIONS)->stderr_fd), \
+    X(fd_list_converter, &(OPTIONS)->pass_fds), \
+    X(bool_false_converter, &(OPTIONS)->close_fds), \
+    X(cgroup_converter, &(OPTIONS)->cgroup), \
+    X(cpu_mask_converter, &(OPTIONS)->cpu_affinity), \
+    X(optional_int_converter, &(OPTIONS)->sched_policy), \
+    X(optional_int_converter, &(OPTIONS)->priority), \
+    X(optional_int_converter, &(OPTIONS)->nice), \
+    X(numa_policy_converter, &(OPTIONS)->numa_policy), \
+    X(rlimits_converter, &(OPTIONS)->rlimits), \
+    X(ioprio_converter, &(OPTIONS)->ioprio), \
+    X(optional_int_converter, &(OPTIONS)->oom_score_adj), \
+    X(int_converter, &(OPTIONS)->namespaces), \
+    X(id_map_converter, &(OPTIONS)->uid_map), \
+    X(id_map_converter, &(OPTIONS)->gid_map)
+
+// path, args, env and the options, for cloneandexecve() and alike
+#if PY_VERSION_HEX >= 0x03030000
+#   define CLONEANDEXECVE_FORMAT(NAME) "O&" "|" "O&" "O&" "$" SPAWN_OPTIONS_FORMAT ":" NAME
+#else
+#   define CLONEANDEXECVE_FORMAT(NAME) "O&" "|" "O&" "O&" SPAWN_OPTIONS_FORMAT ":" NAME
+#endif
+
+
+static void spawn_options_init(SpawnOptions *options) {
+    memset(options, 0, sizeof(*options));
+    options->signal = -1;
+    options->backend = -1;
+    sigemptyset(&options->sigign.set);
+    sigemptyset(&options->sigmask.set);
+    sigemptyset(&options->sigdefault.set);
+    options->stdin_fd = -1;
+    options->stdout_fd = -1;
+    options->stderr_fd = -1;
+    options->cgroup.fd = -1;
+}
+
+
+static void spawn_options_clear(SpawnOptions *options) {
+    Py_CLEAR(options->env_update);
+    pyfree(options->pass_fds.fds);
+    options->pass_fds.fds = NULL;
+    if (options->cgroup.owned) {
+        close(options->cgroup.fd);
+        options->cgroup.owned = false;
+    }
+}
+
+
+static void trampoline_data_init(ExecTrampolineData *data, char *path, char **argv, char **envp) {
+    memset(data, 0, sizeof(*data));
+    data->path = path;
+    data->resolved = NULL;
+    data->argv = argv;
+    data->envp = envp;
+    data->backend = BACKEND_CLONE;
+    data->parent_signal = -1;
+    data->cgroup = -1;
+    data->stdio[0] = -1;
+    data->stdio[1] = -1;
+    data->stdio[2] = -1;
+    data->childpid = -1;
+    data->pidfd = -1;
+    data->fun = NULL;
+    data->error = -1;
+}
+
+
+static bool spawn_options_apply(const SpawnOptions *options, ExecTrampolineData *data) {
+    data->flags = (
+        (options->search_path ? (1 << ETD_SEARCH_PATH) : 0) |
+        (options->setsid ? (1 << ETD_SETSID) : 0) |
+        (options->doublefork ? (1 << ETD_DOUBLEFORK) : 0) |
+        (options->sibling ? (1 << ETD_SIBLING) : 0) |
+        (options->pidfd ? (1 << ETD_PIDFD) : 0) |
+        (options->sigign.count ? (1 << ETD_SIGIGN) : 0) |
+        (options->sigdefault.count ? (1 << ETD_SIGDEFAULT) : 0) |
+        (options->sigmask.given ? (1 << ETD_SIGMASK) : 0) |
+        (options->close_fds ? (1 << ETD_CLOSE_FDS) : 0) |
+        (options->cpu_affinity.given ? (1 << ETD_CPU_AFFINITY) : 0) |
+        (options->sched_policy.given ? (1 << ETD_SCHED) : 0) |
+        (options->nice.given ? (1 << ETD_NICE) : 0) |
+        (options->numa_policy.given ? (1 << ETD_NUMA) : 0) |
+        (options->rlimits.given ? (1 << ETD_RLIMITS) : 0) |
+        (options->ioprio.given ? (1 << ETD_IOPRIO) : 0) |
+        (options->oom_score_adj.given ? (1 << ETD_OOM_SCORE_ADJ) : 0) |
+        0
+    );
+    if (options->backend >= 0) {
+        data->backend = options->backend;
+    } else {
+        data->backend = (options->cgroup.fd >= 0) ? BACKEND_CLONE3 : BACKEND_CLONE;
+    }
+    data->parent_signal = options->signal;
+    data->sigign = options->sigign.set;
+    data->sigdefault = options->sigdefault.set;
+    data->sigmask = options->sigmask.set;
+    data->stdio[0] = options->stdin_fd;
+    data->stdio[1] = options->stdout_fd;
+    data->stdio[2] = options->stderr_fd;
+    data->pass_fds = options->pass_fds.fds;
+    data->pass_fds_count = options->pass_fds.count;
+    data->cgroup = options->cgroup.fd;
+    memcpy(data->cpu_affinity, options->cpu_affinity.mask, sizeof(data->cpu_affinity));
+    data->sched_policy = options->sched_policy.value;
+    data->sched_priority = options->priority.value;
+    data->nice = options->nice.value;
+    data->numa_mode = options->numa_policy.mode;
+    memcpy(data->numa_nodes, options->numa_policy.nodes, sizeof(data->numa_nodes));
+    data->rlimits_given = options->rlimits.given;
+    memcpy(data->rlimits, options->rlimits.limits, sizeof(data->rlimits));
+    data->ioprio = options->ioprio.value;
+    data->oom_score_adj = options->oom_score_adj.value;
+    data->namespaces = options->namespaces;
+    memcpy(data->uid_map, options->uid_map.text, sizeof(data->uid_map));
+    memcpy(data->gid_map, options->gid_map.text, sizeof(data->gid_map));
+    if (data->namespaces & ~CLONE_NAMESPACES) {
+        PyErr_SetString(PyExc_ValueError, "namespaces must be CLONE_NEW* constants of this module");
+        return false;
+    }
+    if ((data->uid_map[0] || data->gid_map[0]) && !(data->namespaces & CLONE_NEWUSER)) {
+        PyErr_SetString(PyExc_ValueError, "uid_map and gid_map need CLONE_NEWUSER in namespaces");
+        return false;
+    }
+    if ((data->oom_score_adj < -1000) || (data->oom_score_adj > 1000)) {
+        PyErr_SetString(PyExc_ValueError, "oom_score_adj must be between -1000 and 1000");
+        return false;
+    }
+    if (options->priority.given && !options->sched_policy.given) {
+        PyErr_SetString(PyExc_ValueError, "priority needs a sched_policy");
+        return false;
+    }
+    return backend_check(data->backend, data);
+}
+
+
+static int pidfd_open_raw(pid_t pid) {
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+}
+
+
+/*
+ * Child stacks are mmap'd once and reused. Each mapping holds two stacks, the
+ * second one for the doublefork grandchild, both with a guard page below:
+ *
+ *     [guard] [doublefork stack] [guard] [stack ... ChildStack]
+ *
+ * Every thread keeps the stack of its last spawn, so the common case takes no
+ * lock, the others are shared in a pool that module_exec fills.
+ */
+#define CHILD_STACK_SIZE (1 << 16)
+#define CHILD_STACK_POOL 4
+
+typedef struct ChildStack {
+    struct ChildStack *next;
+    char *mapping;
+} ChildStack;
+
+static size_t child_stack_page = 4096;
+static pthread_once_t child_stack_once = PTHREAD_ONCE_INIT;
+static pthread_key_t child_stack_key;
+static bool child_stack_key_created = false;
+static pthread_mutex_t child_stack_lock = PTHREAD_MUTEX_INITIALIZER;
+static ChildStack *child_stack_pool = NULL;
+
+
+static size_t child_stack_mapping_size(void) {
+    return 2 * (child_stack_page + CHILD_STACK_SIZE);
+}
+
+
+static ChildStack *child_stack_map(void) {
+    size_t size = child_stack_mapping_size();
+    char *mapping = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    if (
+        (mprotect(mapping + child_stack_page, CHILD_STACK_SIZE, PROT_READ | PROT_WRITE) != 0) ||
+        (mprotect(mapping + size - CHILD_STACK_SIZE, CHILD_STACK_SIZE, PROT_READ | PROT_WRITE) != 0)
+    ) {
+        int error = errno;
+        munmap(mapping, size);
+        errno = error;
+        return NULL;
+    }
+    ChildStack *stack = (ChildStack*) (mapping + size) - 1;
+    stack->next = NULL;
+    stack->mapping = mapping;
+    return stack;
+}
+
+
+// the usable stacks grow down from these addresses
+static char *child_stack_top(ChildStack *stack) {
+    return (char*) ((uintptr_t) stack & ~(uintptr_t) 15);
+}
+
+
+static char *child_stack_bottom(ChildStack *stack) {
+    return stack->mapping + child_stack_mapping_size() - CHILD_STACK_SIZE;
+}
+
+
+static char *child_stack_doublefork_top(ChildStack *stack) {
+    return stack->mapping + child_stack_page + CHILD_STACK_SIZE;
+}
+
+
+static void child_stack_pool_push(ChildStack *stack) {
+    pthread_mutex_lock(&child_stack_lock);
+    stack->next = child_stack_pool;
+    child_stack_pool = stack;
+    pthread_mutex_unlock(&child_stack_lock);
+}
+
+
+static void child_stack_thread_exit(void *stack) {
+    child_stack_pool_push((ChildStack*) stack);
+}
+
+
+static void child_stack_atfork_child(void) {
+    // the other threads' stacks are gone with them, their pool entries stay valid
+    pthread_mutex_init(&child_stack_lock, NULL);
+}
+
+
+static void child_stack_init(void) {
+    long page = sysconf(_SC_PAGESIZE);
+    if (page > 0) {
+        child_stack_page = (size_t) page;
+    }
+    child_stack_key_created = pthread_key_create(&child_stack_key, child_stack_thread_exit) == 0;
+    pthread_atfork(NULL, NULL, child_stack_atfork_child);
+    for (int index = 0; index < CHILD_STACK_POOL; ++index) {
+        ChildStack *stack = child_stack_map();
+        if (!stack) {
+            // spawns map their stacks on demand then
+            break;
+        }
+        child_stack_pool_push(stack);
+    }
+}
+
+
+static ChildStack *child_stack_take(void) {
+    ChildStack *stack = NULL;
+    if (child_stack_key_created) {
+        stack = pthread_getspecific(child_stack_key);
+        if (stack) {
+            pthread_setspecific(child_stack_key, NULL);
+            return stack;
+        }
+    }
+
+    pthread_mutex_lock(&child_stack_lock);
+    stack = child_stack_pool;
+    if (stack) {
+        child_stack_pool = stack->next;
+    }
+    pthread_mutex_unlock(&child_stack_lock);
+    return stack ? stack : child_stack_map();
+}
+
+
+static void child_stack_give(ChildStack *stack) {
+    if (
+        child_stack_key_created && !pthread_getspecific(child_stack_key) &&
+        (pthread_setspecific(child_stack_key, stack) == 0)
+    ) {
+        return;
+    }
+    child_stack_pool_push(stack);
+}
+
+
+static int trampoline_spawn_clone(ExecTrampolineData *data, uint64_t *spawned, ChildStack *child_stack) {
+    int childprocess;
+    // the trampoline clears the flag in the intermediate child
+    bool doublefork = data->flags & (1 << ETD_DOUBLEFORK);
+    bool pidfd = data->flags & (1 << ETD_PIDFD);
+    switch (data->backend) {
+    case BACKEND_POSIX_SPAWN:
+        childprocess = posix_spawn_run(data);
+        if (childprocess < 0) {
+            return -1;
+        }
+        break;
+
+#ifdef HAVE_CLONE3_TRAMPOLINE
+    case BACKEND_CLONE3: {
+        CloneArgs args;
+        memset(&args, 0, sizeof(args));
+        args.flags = CLONE_VFORK | CLONE_VM | CLONE_CLEAR_SIGHAND;
+        if (!doublefork) {
+            args.flags |= (uint64_t) data->namespaces;
+        }
+        if (data->flags & (1 << ETD_SIBLING)) {
+            args.flags |= CLONE_PARENT;
+        }
+        if (!doublefork) {
+            args.flags |= CLONE_PIDFD;
+            args.pidfd = (uint64_t) (uintptr_t) &data->pidfd;
+        } else if (pidfd) {
+            // the intermediate child creates the grandchild's pidfd
+            args.flags |= CLONE_FILES;
+        }
+        if (data->cgroup >= 0) {
+            args.flags |= CLONE_INTO_CGROUP;
+            args.cgroup = (uint64_t) data->cgroup;
+        }
+        args.exit_signal = SIGCHLD;
+        args.stack = (uint64_t) (uintptr_t) child_stack_bottom(child_stack);
+        args.stack_size = (uint64_t) (child_stack_top(child_stack) - child_stack_bottom(child_stack));
+        childprocess = clone3_call(&args, exec_trampoline, data);
+        break;
+    }
+#endif
+
+    default: {
+        int flags = CLONE_VFORK | CLONE_VM | (doublefork ? 0 : data->namespaces);
+        if (data->flags & (1 << ETD_SIBLING)) {
+            flags |= CLONE_PARENT;
+        }
+        if (pidfd) {
+            // the intermediate child creates the grandchild's pidfd
+            flags |= doublefork ? CLONE_FILES : CLONE_PIDFD;
+        }
+        childprocess = clone(exec_trampoline, child_stack_top(child_stack), flags, data, &data->pidfd);
+        break;
+    }
+    }
+    if (childprocess < 0) {
+        data->error = errno;
+        return -1;
+    }
+    if (!doublefork) {
+        // the child's getpid() is relative to its PID namespace
+        data->childpid = childprocess;
+    }
+    if (data->flags & (1 << ETD_STATS)) {
+        *spawned = stats_now();
+    }
+
+    if (doublefork) {
+        // the intermediate child exits right after the grandchild's exec
+        waitpid(childprocess, NULL, __WALL);
+        if (!pidfd || data->fun) {
+            if (data->pidfd >= 0) {
+                close(data->pidfd);
+                data->pidfd = -1;
+            }
+        }
+        return data->fun ? -1 : 0;
+    }
+
+    if (data->fun) {
+        // the child has reported its error and exits, so this does not block long;
+        // __WALL because plain clone() children have no exit signal
+        data->childpid = childprocess;
+        if (data->pidfd >= 0) {
+            close(data->pidfd);
+            data->pidfd = -1;
+        }
+        waitpid(childprocess, NULL, __WALL);
+        return -1;
+    }
+
+    if (pidfd) {
+        // the caller waits on the pidfd, so the child must not be reaped here
+        if (data->pidfd < 0) {
+            // posix_spawn does not return a pidfd
+            data->pidfd = pidfd_open_raw(data->childpid);
+            if (data->pidfd < 0) {
+                data->fun = "pidfd_open";
+                data->error = errno;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if (data->pidfd >= 0) {
+        close(data->pidfd);
+        data->pidfd = -1;
+    }
+    // the child is the caller's to reap, with its status
+    return 0;
+}
+
+
+static int trampoline_spawn_run(ExecTrampolineData *data, uint64_t *spawned) {
+    if (data->backend == BACKEND_POSIX_SPAWN) {
+        return trampoline_spawn_clone(data, spawned, NULL);
+    }
+
+    ChildStack *child_stack = child_stack_take();
+    if (!child_stack) {
+        data->error = errno;
+        return -1;
+    }
+    data->doublefork_stack = child_stack_doublefork_top(child_stack);
+    int outcome = trampoline_spawn_clone(data, spawned, child_stack);
+    // the children have exec'd or exited, the vfork suspension ensures it
+    child_stack_give(child_stack);
+    return outcome;
+}
+
+
+static int trampoline_spawn_local(ExecTrampolineData *data) {
+    uint64_t started = 0;
+    uint64_t spawned = 0;
+    // a doublefork grandchild is not ours to reap
+    bool recorded = !(data->flags & (1 << ETD_DOUBLEFORK));
+    if (__atomic_load_n(&spawn_stats_enabled, __ATOMIC_RELAXED)) {
+        data->flags |= (1 << ETD_STATS);
+        data->stats_child_started = 0;
+        data->stats_child_exec = 0;
+        started = stats_now();
+    } else {
+        data->flags &= ~(1 << ETD_STATS);
+    }
+
+    int outcome = trampoline_spawn_run(data, &spawned);
+    if ((outcome == 0) && recorded) {
+        spawn_time_record(data->childpid);
+    }
+
+    if (started) {
+        uint64_t finished = stats_now();
+        __atomic_fetch_add(&spawn_stats.spawns, 1, __ATOMIC_RELAXED);
+        if (outcome < 0) {
+            stats_add_failure(data->fun ? data->fun : backend_names[data->backend]);
+        }
+        stats_add(STATS_PREPARE, data->stats_prepare, started);
+        stats_add(STATS_CLONE, started, data->stats_child_started);
+        stats_add(STATS_CHILD, data->stats_child_started, data->stats_child_exec);
+        stats_add(STATS_EXEC, data->stats_child_exec, spawned);
+        stats_add(STATS_SPAWN, started, spawned);
+        stats_add(STATS_WAIT, spawned, finished);
+    }
+    return outcome;
+}
+
+
+typedef struct SpawnRequest {
+    struct SpawnRequest *next;
+    ExecTrampolineData *data;
+    int outcome;
+    int done;
+    // signalled instead of done if not -1, for cloneandexecve_nowait()
+    int eventfd;
+} SpawnRequest;
+
+// requests are pushed by the callers and taken all at once by the spawner thread
+static SpawnRequest *spawner_queue = NULL;
+static int spawner_wakeups = 0;
+static bool spawner_enabled = false;
+static bool spawner_started = false;
+static bool spawner_atfork_registered = false;
+
+
+static void futex_wait(int *address, int expected) {
+    syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+
+static void futex_wake(int *address) {
+    syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+
+static void *spawner_main(void *arg) {
+    (void) arg;
+    for (;;) {
+        int wakeups = __atomic_load_n(&spawner_wakeups, __ATOMIC_ACQUIRE);
+        SpawnRequest *pending = __atomic_exchange_n(&spawner_queue, NULL, __ATOMIC_ACQUIRE);
+        if (!pending) {
+            futex_wait(&spawner_wakeups, wakeups);
+            continue;
+        }
+
+        // the queue is a stack, restore the submission order
+        SpawnRequest *ordered = NULL;
+        while (pending) {
+            SpawnRequest *next = pending->next;
+            pending->next = ordered;
+            ordered = pending;
+            pending = next;
+        }
+        while (ordered) {
+            // the caller may return as soon as done is set
+            SpawnRequest *next = ordered->next;
+            ordered->outcome = trampoline_spawn_local(ordered->data);
+            if (ordered->eventfd >= 0) {
+                // the handle may be freed as soon as the eventfd is readable
+                uint64_t one = 1;
+                __atomic_thread_fence(__ATOMIC_RELEASE);
+                while ((write(ordered->eventfd, &one, sizeof(one)) < 0) && (errno == EINTR)) {
+                }
+            } else {
+                __atomic_store_n(&ordered->done, 1, __ATOMIC_RELEASE);
+                futex_wake(&ordered->done);
+            }
+            ordered = next;
+        }
+    }
+    return NULL;
+}
+
+
+static void spawner_atfork_child(void) {
+    // the thread does not exist in the forked child
+    spawner_queue = NULL;
+    spawner_enabled = false;
+    spawner_started = false;
+}
+
+
+// setup_lock is held
+static bool spawner_start_locked(void) {
+    if (spawner_started) {
+        return true;
+    }
+    if (!spawner_atfork_registered) {
+        int error = pthread_atfork(NULL, NULL, spawner_atfork_child);
+        if (error != 0) {
+            errno = error;
+            return false;
+        }
+        spawner_atfork_registered = true;
+    }
+
+    pthread_attr_t attr;
+    int error = pthread_attr_init(&attr);
+    if (error != 0) {
+        errno = error;
+        return false;
+    }
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, 1 << 18);
+
+    // signals are for the Python threads, the spawner inherits a full mask
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    pthread_t thread;
+    error = pthread_create(&thread, &attr, spawner_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    pthread_attr_destroy(&attr);
+    if (error != 0) {
+        errno = error;
+        return false;
+    }
+    __atomic_store_n(&spawner_started, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+static bool spawner_start(void) {
+    if (__atomic_load_n(&spawner_started, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+    pthread_mutex_lock(&setup_lock);
+    bool started = spawner_start_locked();
+    int error = errno;
+    pthread_mutex_unlock(&setup_lock);
+    errno = error;
+    return started;
+}
+
+
+static void spawner_submit(SpawnRequest *request) {
+    SpawnRequest *head = __atomic_load_n(&spawner_queue, __ATOMIC_RELAXED);
+    do {
+        request->next = head;
+    } while (!__atomic_compare_exchange_n(
+        &spawner_queue, &head, request, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED
+    ));
+    __atomic_fetch_add(&spawner_wakeups, 1, __ATOMIC_RELEASE);
+    futex_wake(&spawner_wakeups);
+}
+
+
+static int spawner_spawn(ExecTrampolineData *data) {
+    if (!__atomic_load_n(&spawner_enabled, __ATOMIC_ACQUIRE)) {
+        return trampoline_spawn_local(data);
+    }
+
+    if (!(data->flags & (1 << ETD_SIGMASK))) {
+        // as if this thread had spawned the child
+        pthread_sigmask(SIG_SETMASK, NULL, &data->sigmask);
+        data->flags |= (1 << ETD_SIGMASK);
+    }
+
+    SpawnRequest request = { NULL, data, -1, 0, -1 };
+    spawner_submit(&request);
+    while (!__atomic_load_n(&request.done, __ATOMIC_ACQUIRE)) {
+        futex_wait(&request.done, 0);
+    }
+    return request.outcome;
+}
+
+
+/*
+ * The helper process receives a HelperRequest followed by the strings over a
+ * stream socket, with stdio and cgroup descriptors as SCM_RIGHTS, and answers
+ * with a HelperReply, the pidfd attached. Both sides are this module, so the
+ * trampoline data is sent as is, the pointers only tell whether they were set.
+ *
+ * Every thread sends its requests over a connection of its own, which it
+ * hands to the helper over the control socket on the helper's stdin, with a
+ * HelperConnect. The helper serves each connection on a thread, so only the
+ * setup of a connection takes helper_lock.
+ */
+typedef struct {
+    uint32_t size;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t fds;
+    ExecTrampolineData data;
+} HelperRequest;
+
+typedef struct {
+    int outcome;
+    int childpid;
+    int error;
+    int pidfd;
+    char fun[sizeof(((ExecTrampolineData*) NULL)->helper_fun)];
+} HelperReply;
+
+typedef struct {
+    uint32_t magic;
+} HelperConnect;
+
+enum {
+    HELPER_FD_CGROUP = 3,
+    HELPER_FD_COUNT,
+};
+
+#define HELPER_MAX_REQUEST (64 << 20)
+#define HELPER_MARKER "--pdeathsignal-helper"
+#define HELPER_CONNECT_MAGIC 0x70647363u
+
+static const char helper_transport_fun[] = "spawn helper";
+
+static pthread_mutex_t helper_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool helper_enabled = false;
+static bool helper_atfork_registered = false;
+static char **helper_argv = NULL;
+static int helper_socket = -1;
+static pid_t helper_pid = -1;
+// changes whenever the helper stops, the connections to it are stale then
+static unsigned long helper_generation = 0;
+
+static pthread_key_t helper_connection_key;
+static bool helper_connection_key_created = false;
+static __thread int helper_connection = -1;
+static __thread unsigned long helper_connection_generation = 0;
+
+// the helper's side of the connections, to end them when the control socket closes
+typedef struct HelperServed {
+    struct HelperServed *next;
+    int sock;
+} HelperServed;
+
+static pthread_mutex_t helper_served_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t helper_served_done = PTHREAD_COND_INITIALIZER;
+static HelperServed *helper_served = NULL;
+
+
+static bool helper_write_all(int sock, const char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(sock, buffer, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += sent;
+        size -= (size_t) sent;
+    }
+    return true;
+}
+
+
+static bool helper_read_all(int sock, char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t got = recv(sock, buffer, size, 0);
+        if (got <= 0) {
+            if ((got < 0) && (errno == EINTR)) {
+                continue;
+            }
+            if (got == 0) {
+                errno = ECONNRESET;
+            }
+            return false;
+        }
+        buffer += got;
+        size -= (size_t) got;
+    }
+    return true;
+}
+
+
+static bool helper_send(
+    int sock, const void *header, size_t header_size, const void *body, size_t body_size,
+    const int *fds, int fd_count
+) {
+    struct iovec iov[2] = {
+        { (void*) header, header_size },
+        { (void*) body, body_size },
+    };
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * HELPER_FD_COUNT)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = body_size ? 2 : 1;
+    if (fd_count > 0) {
+        message.msg_control = control.buffer;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &message, MSG_NOSIGNAL);
+    } while ((sent < 0) && (errno == EINTR));
+    if (sent < 0) {
+        return false;
+    }
+
+    // the descriptors went with the first byte, the rest is plain data
+    size_t done = (size_t) sent;
+    if (done < header_size) {
+        if (!helper_write_all(sock, (const char*) header + done, header_size - done)) {
+            return false;
+        }
+        done = header_size;
+    }
+    done -= header_size;
+    return helper_write_all(sock, (const char*) body + done, body_size - done);
+}
+
+
+// returns the number of received descriptors, or -1
+static int helper_receive(int sock, void *header, size_t header_size, int *fds, int max_fds) {
+    struct iovec iov = { header, header_size };
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * HELPER_FD_COUNT)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * max_fds);
+
+    ssize_t got;
+    do {
+        got = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+    } while ((got < 0) && (errno == EINTR));
+    if (got <= 0) {
+        if (got == 0) {
+            errno = ECONNRESET;
+        }
+        return -1;
+    }
+
+    int fd_count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+            int count = (int) ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            for (int index = 0; index < count; ++index) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + sizeof(int) * index, sizeof(int));
+                if (fd_count < max_fds) {
+                    fds[fd_count++] = fd;
+                } else {
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    if (
+        (message.msg_flags & MSG_CTRUNC) ||
+        !helper_read_all(sock, (char*) header + got, header_size - (size_t) got)
+    ) {
+        if (message.msg_flags & MSG_CTRUNC) {
+            errno = EPROTO;
+        }
+        while (fd_count > 0) {
+            close(fds[--fd_count]);
+        }
+        return -1;
+    }
+    return fd_count;
+}
+
+
+static char *helper_next_string(char **cursor, char *end) {
+    char *string = *cursor;
+    char *terminator = (string < end) ? memchr(string, '\0', (size_t) (end - string)) : NULL;
+    if (!terminator) {
+        return NULL;
+    }
+    *cursor = terminator + 1;
+    return string;
+}
+
+
+static bool helper_serve_one(int sock) {
+    HelperRequest request;
+    int fds[HELPER_FD_COUNT];
+    int fd_count = helper_receive(sock, &request, sizeof(request), fds, HELPER_FD_COUNT);
+    if (fd_count < 0) {
+        return false;
+    }
+
+    bool result = false;
+    char *body = NULL;
+    char **vector = NULL;
+    ExecTrampolineData *data = &request.data;
+    if ((request.size > HELPER_MAX_REQUEST) || (request.argc + request.envc > request.size)) {
+        goto end;
+    }
+    body = pymalloc(request.size ? request.size : 1);
+    vector = pymalloc(sizeof(char*) * (request.argc + request.envc + 2));
+    if (!body || !vector || !helper_read_all(sock, body, request.size)) {
+        goto end;
+    }
+
+    char *cursor = body;
+    char *end_of_body = body + request.size;
+    data->path = helper_next_string(&cursor, end_of_body);
+    if (data->resolved) {
+        data->resolved = helper_next_string(&cursor, end_of_body);
+    }
+    data->argv = vector;
+    data->envp = vector + request.argc + 1;
+    for (uint32_t index = 0; index < request.argc; ++index) {
+        data->argv[index] = helper_next_string(&cursor, end_of_body);
+    }
+    data->argv[request.argc] = NULL;
+    for (uint32_t index = 0; index < request.envc; ++index) {
+        data->envp[index] = helper_next_string(&cursor, end_of_body);
+    }
+    data->envp[request.envc] = NULL;
+    if (!data->path || (cursor != end_of_body)) {
+        goto end;
+    }
+
+    int received = 0;
+    for (int target = 0; target < HELPER_FD_COUNT; ++target) {
+        int fd = -1;
+        if (request.fds & (1u << target)) {
+            if (received >= fd_count) {
+                goto end;
+            }
+            fd = fds[received++];
+        }
+        if (target == HELPER_FD_CGROUP) {
+            data->cgroup = fd;
+        } else {
+            data->stdio[target] = fd;
+        }
+    }
+
+    // CLONE_PARENT, the child belongs to the helper's caller
+    data->flags |= (1 << ETD_SIBLING);
+    data->pass_fds = NULL;
+    data->pass_fds_count = 0;
+    data->childpid = -1;
+    data->pidfd = -1;
+    data->fun = NULL;
+    data->error = -1;
+    HelperReply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.outcome = trampoline_spawn_local(data);
+    reply.childpid = data->childpid;
+    reply.error = data->error;
+    reply.pidfd = (reply.outcome == 0) && (data->pidfd >= 0);
+    if (data->fun) {
+        strncpy(reply.fun, data->fun, sizeof(reply.fun) - 1);
+    }
+    result = helper_send(sock, &reply, sizeof(reply), NULL, 0, &data->pidfd, reply.pidfd ? 1 : 0);
+    if (data->pidfd >= 0) {
+        close(data->pidfd);
+    }
+
+  end:
+    pyfree(vector);
+    pyfree(body);
+    for (int index = 0; index < fd_count; ++index) {
+        close(fds[index]);
+    }
+    return result;
+}
+
+
+static void helper_served_unlink(HelperServed *served) {
+    for (HelperServed **link = &helper_served; *link; link = &(*link)->next) {
+        if (*link == served) {
+            *link = served->next;
+            break;
+        }
+    }
+}
+
+
+static void *helper_connection_main(void *argument) {
+    HelperServed *served = argument;
+    while (helper_serve_one(served->sock)) {
+    }
+    pthread_mutex_lock(&helper_served_lock);
+    helper_served_unlink(served);
+    if (!helper_served) {
+        pthread_cond_signal(&helper_served_done);
+    }
+    pthread_mutex_unlock(&helper_served_lock);
+    close(served->sock);
+    pyfree(served);
+    return NULL;
+}
+
+
+static void helper_accept_all(int sock) {
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        HelperConnect connect;
+        int connection = -1;
+        int received = helper_receive(sock, &connect, sizeof(connect), &connection, 1);
+        if (received < 0) {
+            break;
+        }
+        HelperServed *served = (received == 1) ? pymalloc(sizeof(HelperServed)) : NULL;
+        if (!served || (connect.magic != HELPER_CONNECT_MAGIC)) {
+            // the connection fails on the caller's side
+            pyfree(served);
+            if (connection >= 0) {
+                close(connection);
+            }
+            continue;
+        }
+        served->sock = connection;
+        // linked before the thread runs, the exit below waits for it
+        pthread_mutex_lock(&helper_served_lock);
+        served->next = helper_served;
+        helper_served = served;
+        pthread_mutex_unlock(&helper_served_lock);
+        pthread_t thread;
+        if (pthread_create(&thread, &attributes, helper_connection_main, served) != 0) {
+            pthread_mutex_lock(&helper_served_lock);
+            helper_served_unlink(served);
+            pthread_mutex_unlock(&helper_served_lock);
+            close(connection);
+            pyfree(served);
+        }
+    }
+    pthread_attr_destroy(&attributes);
+
+    // requests that were sent already are still answered, then the connections end
+    pthread_mutex_lock(&helper_served_lock);
+    for (HelperServed *served = helper_served; served; served = served->next) {
+        shutdown(served->sock, SHUT_RD);
+    }
+    while (helper_served) {
+        pthread_cond_wait(&helper_served_done, &helper_served_lock);
+    }
+    pthread_mutex_unlock(&helper_served_lock);
+}
+
+
+// helper_command() passes it after the code, so sys.argv is ['-c', HELPER_MARKER]
+static bool helper_started_by_us(void) {
+    PyObject *argv = PySys_GetObject("argv");
+    if (!argv || !PyList_Check(argv) || (PyList_GET_SIZE(argv) != 2)) {
+        return false;
+    }
+    PyObject *marker = as_bytes(PyList_GET_ITEM(argv, 1));
+    if (!marker) {
+        PyErr_Clear();
+        return false;
+    }
+    bool result = strcmp(PyBytes_AS_STRING(marker), HELPER_MARKER) == 0;
+    Py_DECREF(marker);
+
+    struct stat st;
+    return result && (fstat(0, &st) == 0) && S_ISSOCK(st.st_mode);
+}
+
+
+static PyObject *helper_main_impl(PyObject *self, PyObject *no_args) {
+    (void) self;
+    (void) no_args;
+
+    if (!helper_started_by_us()) {
+        PyErr_SetString(PyExc_RuntimeError, "_helper_main() only runs in the helper of use_helper_process()");
+        return NULL;
+    }
+
+    // the children must not inherit the socket as their stdin
+    int sock = fcntl(0, F_DUPFD_CLOEXEC, 3);
+    if (sock < 0) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    int null = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if ((null < 0) || (dup2(null, 0) < 0)) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        if (null >= 0) {
+            close(null);
+        }
+        close(sock);
+        return NULL;
+    }
+    close(null);
+
+    Py_BEGIN_ALLOW_THREADS
+    helper_accept_all(sock);
+    Py_END_ALLOW_THREADS
+    // the caller closed the socket and every connection was served
+    _exit(0);
+}
+
+
+static void helper_atfork_child(void) {
+    // the helper and its socket belong to the parent process
+    pthread_mutex_init(&helper_lock, NULL);
+    helper_enabled = false;
+    if (helper_socket >= 0) {
+        close(helper_socket);
+    }
+    helper_socket = -1;
+    helper_pid = -1;
+    if (helper_connection >= 0) {
+        close(helper_connection);
+        if (helper_connection_key_created) {
+            pthread_setspecific(helper_connection_key, NULL);
+        }
+    }
+    helper_connection = -1;
+    helper_generation += 1;
+}
+
+
+// helper_lock is held
+static bool helper_start(void) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+        return false;
+    }
+
+    ExecTrampolineData data;
+    trampoline_data_init(&data, helper_argv[0], helper_argv, NULL);
+    data.parent_signal = SIGKILL;
+    data.stdio[0] = pair[1];
+    int outcome = spawner_spawn(&data);
+    close(pair[1]);
+    if (outcome < 0) {
+        close(pair[0]);
+        errno = data.error;
+        return false;
+    }
+    helper_socket = pair[0];
+    helper_pid = data.childpid;
+    return true;
+}
+
+
+// helper_lock is held
+static void helper_stop(bool kill_helper) {
+    __atomic_add_fetch(&helper_generation, 1, __ATOMIC_RELEASE);
+    if (helper_socket >= 0) {
+        // the helper exits when it reads the end of the stream
+        close(helper_socket);
+        helper_socket = -1;
+    }
+    if (helper_pid > 0) {
+        if (kill_helper) {
+            kill(helper_pid, SIGKILL);
+        }
+        waitpid(helper_pid, NULL, __WALL);
+        helper_pid = -1;
+    }
+}
+
+
+static void helper_connection_thread_exit(void *value) {
+    close((int) (intptr_t) value - 1);
+}
+
+
+static void helper_disconnect(void) {
+    if (helper_connection >= 0) {
+        close(helper_connection);
+        helper_connection = -1;
+        if (helper_connection_key_created) {
+            pthread_setspecific(helper_connection_key, NULL);
+        }
+    }
+}
+
+
+/*
+ * Returns the connection of this thread, or -1 with errno set. Sets disabled
+ * if the helper was disabled concurrently, fresh if the connection is new.
+ */
+static int helper_connect(bool *fresh, bool *disabled) {
+    *fresh = false;
+    *disabled = false;
+    unsigned long generation = __atomic_load_n(&helper_generation, __ATOMIC_ACQUIRE);
+    if ((helper_connection >= 0) && (helper_connection_generation == generation)) {
+        return helper_connection;
+    }
+    helper_disconnect();
+    *fresh = true;
+
+    pthread_mutex_lock(&helper_lock);
+    if (!__atomic_load_n(&helper_enabled, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_unlock(&helper_lock);
+        *disabled = true;
+        return -1;
+    }
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool started = helper_socket < 0;
+        if (started && !helper_start()) {
+            break;
+        }
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+            break;
+        }
+        HelperConnect connect = { HELPER_CONNECT_MAGIC };
+        bool sent = helper_send(helper_socket, &connect, sizeof(connect), NULL, 0, &pair[1], 1);
+        int error = errno;
+        close(pair[1]);
+        if (!sent) {
+            close(pair[0]);
+            helper_stop(true);
+            errno = error;
+            if (!started && ((error == EPIPE) || (error == ECONNRESET))) {
+                // the helper has gone away, start a new one
+                continue;
+            }
+            break;
+        }
+        helper_connection = pair[0];
+        helper_connection_generation = helper_generation;
+        if (helper_connection_key_created) {
+            pthread_setspecific(helper_connection_key, (void*) (intptr_t) (helper_connection + 1));
+        }
+        break;
+    }
+    int error = errno;
+    pthread_mutex_unlock(&helper_lock);
+    errno = error;
+    return helper_connection;
+}
+
+
+// the helper cannot hand over these, the children would not be ours or miss descriptors
+static bool helper_can_proxy(const ExecTrampolineData *data) {
+    return (
+        (data->backend != BACKEND_POSIX_SPAWN) &&
+        !(data->flags & ((1 << ETD_SIBLING) | (1 << ETD_DOUBLEFORK))) &&
+        (data->pass_fds_count == 0)
+    );
+}
+
+
+static int helper_spawn(ExecTrampolineData *data) {
+    char *resolved = data->resolved;
+    char **envp = data->envp ? data->envp : environ;
+    HelperRequest request;
+    memset(&request, 0, sizeof(request));
+
+    size_t size = strlen(data->path) + 1 + (resolved ? strlen(resolved) + 1 : 0);
+    for (; data->argv[request.argc]; ++request.argc) {
+        size += strlen(data->argv[request.argc]) + 1;
+    }
+    for (; envp[request.envc]; ++request.envc) {
+        size += strlen(envp[request.envc]) + 1;
+    }
+    if (size > HELPER_MAX_REQUEST) {
+        data->fun = (char*) helper_transport_fun;
+        data->error = E2BIG;
+        return -1;
+    }
+    char *body = pymalloc(size);
+    if (!body) {
+        data->fun = (char*) helper_transport_fun;
+        data->error = ENOMEM;
+        return -1;
+    }
+    char *cursor = body;
+    size_t length = strlen(data->path) + 1;
+    memcpy(cursor, data->path, length);
+    cursor += length;
+    if (resolved) {
+        length = strlen(resolved) + 1;
+        memcpy(cursor, resolved, length);
+        cursor += length;
+    }
+    for (uint32_t index = 0; index < request.argc; ++index) {
+        length = strlen(data->argv[index]) + 1;
+        memcpy(cursor, data->argv[index], length);
+        cursor += length;
+    }
+    for (uint32_t index = 0; index < request.envc; ++index) {
+        length = strlen(envp[index]) + 1;
+        memcpy(cursor, envp[index], length);
+        cursor += length;
+    }
+    request.size = (uint32_t) size;
+
+    if (!(data->flags & (1 << ETD_SIGMASK))) {
+        // as if this thread had spawned the child
+        pthread_sigmask(SIG_SETMASK, NULL, &data->sigmask);
+        data->flags |= (1 << ETD_SIGMASK);
+    }
+    request.data = *data;
+
+    // stdio that is not redirected is this process', not the helper's
+    int fds[HELPER_FD_COUNT];
+    int fd_count = 0;
+    for (int target = 0; target < 3; ++target) {
+        int source = (data->stdio[target] >= 0) ? data->stdio[target] : target;
+        if ((data->stdio[target] >= 0) || (fcntl(source, F_GETFD) >= 0)) {
+            request.fds |= 1u << target;
+            fds[fd_count++] = source;
+        }
+    }
+    if (data->cgroup >= 0) {
+        request.fds |= 1u << HELPER_FD_CGROUP;
+        fds[fd_count++] = data->cgroup;
+    }
+
+    HelperReply reply;
+    int pidfd = -1;
+    int received = -1;
+    int error = 0;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool fresh;
+        bool disabled;
+        int sock = helper_connect(&fresh, &disabled);
+        if (disabled) {
+            pyfree(body);
+            return spawner_spawn(data);
+        }
+        if (sock < 0) {
+            error = errno;
+            break;
+        }
+        if (!helper_send(sock, &request, sizeof(request), body, size, fds, fd_count)) {
+            error = errno;
+            helper_disconnect();
+            if (!fresh && ((error == EPIPE) || (error == ECONNRESET))) {
+                // the helper has gone away or stopped before it got the request, connect again
+                continue;
+            }
+            break;
+        }
+        received = helper_receive(sock, &reply, sizeof(reply), &pidfd, 1);
+        if (received < 0) {
+            error = errno;
+            helper_disconnect();
+        }
+        break;
+    }
+    pyfree(body);
+
+    if (received < 0) {
+        data->fun = (char*) helper_transport_fun;
+        data->error = error;
+        return -1;
+    }
+
+    data->childpid = reply.childpid;
+    data->error = reply.error;
+    if (reply.outcome < 0) {
+        if (pidfd >= 0) {
+            close(pidfd);
+        }
+        if (reply.fun[0]) {
+            memcpy(data->helper_fun, reply.fun, sizeof(data->helper_fun));
+            data->helper_fun[sizeof(data->helper_fun) - 1] = '\0';
+            data->fun = data->helper_fun;
+        }
+        if (reply.childpid > 0) {
+            // the failed child is ours, not the helper's
+            waitpid(reply.childpid, NULL, __WALL);
+        }
+        return -1;
+    }
+
+    if (data->flags & (1 << ETD_PIDFD)) {
+        data->pidfd = pidfd;
+        return 0;
+    }
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+    return 0;
+}
+
+
+static int trampoline_spawn(ExecTrampolineData *data) {
+    if (__atomic_load_n(&helper_enabled, __ATOMIC_ACQUIRE) && helper_can_proxy(data)) {
+        bool recorded = !(data->flags & (1 << ETD_DOUBLEFORK));
+        int outcome = helper_spawn(data);
+        if ((outcome == 0) && recorded) {
+            // the helper recorded the spawn in its own table
+            spawn_time_record(data->childpid);
+        }
+        return outcome;
+    }
+    return spawner_spawn(data);
+}
+
+
+static PyObject *trampoline_result(const ExecTrampolineData *data, int outcome) {
+    if (outcome < 0) {
+        char message[128];
+        if (data->fun == helper_transport_fun) {
+            snprintf(message, sizeof(message), "%s failed", helper_transport_fun);
+        } else if (data->fun) {
+            snprintf(
+                message, sizeof(message), "%s successful, but %s failed",
+                backend_names[data->backend], data->fun
+            );
+        } else {
+            snprintf(message, sizeof(message), "%s failed", backend_names[data->backend]);
+        }
+        // OSError(errno, message) picks the matching subclass
+        PyObject *value = Py_BuildValue("(is)", data->error, message);
+        if (value) {
+            PyErr_SetObject(PyExc_OSError, value);
+            Py_DECREF(value);
+        }
+        return NULL;
+    }
+
+    if (data->flags & (1 << ETD_PIDFD)) {
+        PyObject *result = Py_BuildValue("(ii)", data->childpid, data->pidfd);
+        if (!result) {
+            close(data->pidfd);
+        }
+        return result;
+    } else {
+        return int_or_errno(true, data->childpid);
+    }
+}
+
+
+static bool process_group_prepare(pid_t *group, ExecTrampolineData *data);
+
+
+// the converted arguments of cloneandexecve()
+typedef struct {
+    PyObject *path;
+    CStringArray args;
+    CStringArray env;
+    SpawnOptions options;
+} SpawnCall;
+
+
+static void spawn_call_init(SpawnCall *call) {
+    call->path = NULL;
+    call->args.owner = NULL;
+    call->args.items = NULL;
+    call->env.owner = NULL;
+    call->env.items = NULL;
+    spawn_options_init(&call->options);
+}
+
+
+static void spawn_call_clear(SpawnCall *call) {
+    Py_CLEAR(call->path);
+    cstring_array_clear(&call->args);
+    cstring_array_clear(&call->env);
+    spawn_options_clear(&call->options);
+}
+
+
+static bool spawn_call_parse(SpawnCall *call, PyObject *args, PyObject *kwargs, const char *format) {
+    return PyArg_ParseTupleAndKeywords(
+        args, kwargs, format,
+        (char**) cloneandexecve_keywords,
+        path_converter, &call->path,
+        // |
+        cstring_array_converter, &call->args,
+        cstring_array_converter, &call->env,
+        // $
+        SPAWN_OPTIONS_CONVERTERS(&call->options)
+    );
+}
+
+
+#ifdef HAVE_FASTCALL
+static const KeywordParser cloneandexecve_parser = {
+    "cloneandexecve", cloneandexecve_keywords, 3 + SPAWN_OPTIONS_COUNT, 3, 1,
+};
+
+
+static bool spawn_call_parse_fast(
+    ModuleState *state, SpawnCall *call, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames
+) {
+    PyObject *values[3 + SPAWN_OPTIONS_COUNT];
+    const ArgTarget targets[3 + SPAWN_OPTIONS_COUNT] = {
+        ARG_CONVERTER_ENTRY(path_converter, &call->path),
+        ARG_CONVERTER_ENTRY(cstring_array_converter, &call->args),
+        ARG_CONVERTER_ENTRY(cstring_array_converter, &call->env),
+        SPAWN_OPTIONS_CONVERTERS_WITH(ARG_CONVERTER_ENTRY, &call->options)
+    };
+    return (
+        keywords_unpack(&cloneandexecve_parser, state->cloneandexecve_kwnames, args, nargs, kwnames, values) &&
+        arguments_convert(values, targets, 3 + SPAWN_OPTIONS_COUNT)
+    );
+}
+#endif
+
+
+// group is NULL, or the process group of a Supervisor to spawn into
+static PyObject *cloneandexecve_run(ModuleState *state, SpawnCall *call, pid_t *group, uint64_t prepare) {
+    PyObject *result = NULL;
+    PyObject *exec_resolved = NULL;
+    CStringArray exec_merged_env = { NULL, NULL };
+    SpawnOptions *options = &call->options;
+
+    if (options->env_update && !environ_merge(state, call->env.items, options->env_update, &exec_merged_env)) {
+        goto end;
+    }
+
+    char *static_argv_list[] = { PyBytes_AS_STRING(call->path), NULL };
+    ExecTrampolineData trampoline_data;
+    trampoline_data_init(
+        &trampoline_data,
+        static_argv_list[0],
+        (call->args.items ? call->args.items : static_argv_list),
+        (options->env_update ? exec_merged_env.items : call->env.items)
+    );
+    if (!spawn_options_apply(options, &trampoline_data)) {
+        goto end;
+    }
+
+    if (options->search_path) {
+        exec_resolved = path_resolve(state, static_argv_list[0]);
+        if (!exec_resolved) {
+            goto end;
+        } else if (exec_resolved != Py_None) {
+            trampoline_data.resolved = PyBytes_AS_STRING(exec_resolved);
+        }
+    }
+    if (group && !process_group_prepare(group, &trampoline_data)) {
+        goto end;
+    }
+
+    trampoline_data.stats_prepare = prepare;
+    int outcome;
+    if (group && (*group == 0)) {
+        // stay attached, so concurrent spawns cannot create a second group
+        outcome = trampoline_spawn(&trampoline_data);
+        if (outcome == 0) {
+            *group = trampoline_data.childpid;
+        }
+    } else {
+        Py_BEGIN_ALLOW_THREADS
+        outcome = trampoline_spawn(&trampoline_data);
+        Py_END_ALLOW_THREADS
+    }
+    result = trampoline_result(&trampoline_data, outcome);
+
+  end:
+    Py_XDECREF(exec_resolved);
+    cstring_array_clear(&exec_merged_env);
+    return result;
+}
+
+
+static PyObject *cloneandexecve_impl(PyObject *self, FASTCALL_PARAMETERS) {
+    uint64_t prepare = stats_started();
+    ModuleState *state = module_state(self);
+    PyObject *result = NULL;
+    SpawnCall call;
+    spawn_call_init(&call);
+#ifdef HAVE_FASTCALL
+    if (spawn_call_parse_fast(state, &call, args, nargs, kwnames)) {
+#else
+    if (spawn_call_parse(&call, args, kwargs, CLONEANDEXECVE_FORMAT("cloneandexecve"))) {
+#endif
+        result = cloneandexecve_run(state, &call, NULL, prepare);
+    }
+    spawn_call_clear(&call);
+    return result;
+}
+
+
+static int spawn_spec_converter(PyObject *obj, PyObject **path, CStringArray *args) {
+    *path = NULL;
+    args->owner = NULL;
+    args->items = NULL;
+    if (PyTuple_Check(obj)) {
+        PyObject *spec_path = NULL;
+        PyObject *spec_args = NULL;
+        if (!PyArg_ParseTuple(obj, "O|O:spec", &spec_path, &spec_args)) {
+            return false;
+        }
+        if (!path_converter(spec_path, path)) {
+            return false;
+        }
+        if (!cstring_array_converter(spec_args, args)) {
+            Py_CLEAR(*path);
+            return false;
+        }
+        return true;
+    } else {
+        return path_converter(obj, path);
+    }
+}
+
+
+typedef struct {
+    PyObject *path;
+    PyObject *resolved;
+    CStringArray args;
+    char *static_argv[2];
+    ExecTrampolineData data;
+    int outcome;
+} SpawnSlot;
+
+
+static bool spawn_slot_init(ModuleState *state, SpawnSlot *slot, PyObject *spec, const SpawnOptions *options, char **envp) {
+    if (!spawn_spec_converter(spec, &slot->path, &slot->args)) {
+        return false;
+    }
+
+    slot->static_argv[0] = PyBytes_AS_STRING(slot->path);
+    slot->static_argv[1] = NULL;
+    trampoline_data_init(
+        &slot->data,
+        slot->static_argv[0],
+        (slot->args.items ? slot->args.items : slot->static_argv),
+        envp
+    );
+    if (!spawn_options_apply(options, &slot->data)) {
+        return false;
+    }
+    if (options->search_path) {
+        slot->resolved = path_resolve(state, slot->static_argv[0]);
+        if (!slot->resolved) {
+            return false;
+        } else if (slot->resolved != Py_None) {
+            slot->data.resolved = PyBytes_AS_STRING(slot->resolved);
+        }
+    }
+    return true;
+}
+
+
+static void spawn_slots_free(SpawnSlot *slots, Py_ssize_t count) {
+    if (slots) {
+        for (Py_ssize_t index = 0; index < count; ++index) {
+            cstring_array_clear(&slots[index].args);
+            Py_XDECREF(slots[index].path);
+            Py_XDECREF(slots[index].resolved);
+        }
+    }
+    pyfree(slots);
+}
+
+
+static PyObject *cloneandexecve_many_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    ModuleState *state = module_state(self);
+
+    uint64_t prepare = stats_started();
+    PyObject *result = NULL;
+    PyObject *specs_arg = NULL;
+    PyObject *exec_specs = NULL;
+    CStringArray exec_env = { NULL, NULL };
+    CStringArray exec_merged_env = { NULL, NULL };
+    SpawnSlot *slots = NULL;
+    Py_ssize_t count = 0;
+    SpawnOptions options;
+    spawn_options_init(&options);
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs,
+            "O"
+        "|" "O&"
+#if PY_VERSION_HEX >= 0x03030000
+        "$"
+#endif
+        SPAWN_OPTIONS_FORMAT
+        ":" "cloneandexecve_many",
+        (char**) cloneandexecve_many_keywords,
+        &specs_arg,
+        // |
+        cstring_array_converter, &exec_env,
+        // $
+        SPAWN_OPTIONS_CONVERTERS(&options)
+    )) {
+        goto end;
+    }
+
+    exec_specs = PySequence_Fast(specs_arg, "specs must be a sequence");
+    if (!exec_specs) {
+        goto end;
+    }
+    count = PySequence_Fast_GET_SIZE(exec_specs);
+
+    if (options.env_update && !environ_merge(state, exec_env.items, options.env_update, &exec_merged_env)) {
+        goto end;
+    }
+
+    slots = pymalloc(sizeof(SpawnSlot) * (count + 1));
+    if (!slots) {
+        PyErr_NoMemory();
+        goto end;
+    }
+    memset(slots, 0, sizeof(SpawnSlot) * (count + 1));
+
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        char **envp = options.env_update ? exec_merged_env.items : exec_env.items;
+        if (!spawn_slot_init(state, &slots[index], PySequence_Fast_GET_ITEM(exec_specs, index), &options, envp)) {
+            goto end;
+        }
+    }
+
+    if (count > 0) {
+        // later children would include the earlier spawns
+        slots[0].data.stats_prepare = prepare;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        SpawnSlot *slot = &slots[index];
+        slot->outcome = trampoline_spawn(&slot->data);
+    }
+    Py_END_ALLOW_THREADS
+
+    result = PyList_New(count);
+    if (!result) {
+        goto end;
+    }
+
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        SpawnSlot *slot = &slots[index];
+        PyObject *elem = trampoline_result(&slot->data, slot->outcome);
+        if (!elem) {
+            // per-child errors are returned as exception instances
+            PyObject *type, *value, *traceback;
+            PyErr_Fetch(&type, &value, &traceback);
+            PyErr_NormalizeException(&type, &value, &traceback);
+            Py_XDECREF(type);
+            Py_XDECREF(traceback);
+            elem = value;
+            if (!elem) {
+                Py_CLEAR(result);
+                goto end;
+            }
+        }
+        PyList_SET_ITEM(result, index, elem);
+    }
+
+  end:
+    spawn_slots_free(slots, count);
+    Py_XDECREF(exec_specs);
+    cstring_array_clear(&exec_env);
+    cstring_array_clear(&exec_merged_env);
+    spawn_options_clear(&options);
+    return result;
+}
+
+
+static PyObject *spawn_pipeline_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    ModuleState *state = module_state(self);
+
+    uint64_t prepare = stats_started();
+    PyObject *result = NULL;
+    PyObject *specs_arg = NULL;
+    PyObject *exec_specs = NULL;
+    CStringArray exec_env = { NULL, NULL };
+    CStringArray exec_merged_env = { NULL, NULL };
+    SpawnSlot *slots = NULL;
+    int *pipes = NULL;
+    Py_ssize_t count = 0;
+    OptionalInt pipe_size = { false, 0 };
+    bool direct = false;
+    SpawnOptions options;
+    spawn_options_init(&options);
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs,
+            "O"
+        "|" "O&" "O&" "O&"
+#if PY_VERSION_HEX >= 0x03030000
+        "$"
+#endif
+        SPAWN_OPTIONS_FORMAT
+        ":" "spawn_pipeline",
+        (char**) spawn_pipeline_keywords,
+        &specs_arg,
+        // |
+        cstring_array_converter, &exec_env,
+        optional_int_converter, &pipe_size,
+        bool_false_converter, &direct,
+        // $
+        SPAWN_OPTIONS_CONVERTERS(&options)
+    )) {
+        goto end;
+    }
+
+    exec_specs = PySequence_Fast(specs_arg, "specs must be a sequence");
+    if (!exec_specs) {
+        goto end;
+    }
+    count = PySequence_Fast_GET_SIZE(exec_specs);
+    if (count == 0) {
+        PyErr_SetString(PyExc_ValueError, "A pipeline needs at least one spec");
+        goto end;
+    } else if (options.setsid || options.sibling) {
+        PyErr_SetString(PyExc_ValueError, "A pipeline cannot spawn with setsid or sibling");
+        goto end;
+    }
+
+    if (options.env_update && !environ_merge(state, exec_env.items, options.env_update, &exec_merged_env)) {
+        goto end;
+    }
+
+    slots = pymalloc(sizeof(SpawnSlot) * count);
+    pipes = pymalloc(sizeof(int) * 2 * count);
+    if (!slots || !pipes) {
+        PyErr_NoMemory();
+        goto end;
+    }
+    memset(slots, 0, sizeof(SpawnSlot) * count);
+    for (Py_ssize_t index = 0; index < 2 * count; ++index) {
+        pipes[index] = -1;
+    }
+
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        char **envp = options.env_update ? exec_merged_env.items : exec_env.items;
+        if (!spawn_slot_init(state, &slots[index], PySequence_Fast_GET_ITEM(exec_specs, index), &options, envp)) {
+            goto end;
+        }
+    }
+
+    // pipes[2 * i] is read by child i + 1, pipes[2 * i + 1] written by child i
+    for (Py_ssize_t index = 0; index + 1 < count; ++index) {
+        int *ends = &pipes[2 * index];
+        if (pipe2(ends, O_CLOEXEC | (direct ? O_DIRECT : 0)) != 0) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            goto end;
+        }
+        if (pipe_size.given && (fcntl(ends[1], F_SETPIPE_SZ, pipe_size.value) < 0)) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            goto end;
+        }
+        slots[index].data.stdio[1] = ends[1];
+        slots[index + 1].data.stdio[0] = ends[0];
+    }
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        slots[index].data.flags |= (1 << ETD_SETPGID);
+    }
+    slots[0].data.stats_prepare = prepare;
+
+    Py_ssize_t failed = -1;
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        SpawnSlot *slot = &slots[index];
+        // the first child starts the group
+        slot->data.pgid = index ? slots[0].data.childpid : 0;
+        slot->outcome = trampoline_spawn(&slot->data);
+        if (slot->outcome < 0) {
+            failed = index;
+            break;
+        }
+    }
+
+    if (failed >= 0) {
+        if (failed > 0) {
+            kill(-slots[0].data.childpid, SIGKILL);
+        }
+        for (Py_ssize_t index = 0; index < failed; ++index) {
+            SpawnSlot *slot = &slots[index];
+            if (slot->data.flags & (1 << ETD_PIDFD)) {
+                close(slot->data.pidfd);
+            }
+            if (!(slot->data.flags & (1 << ETD_DOUBLEFORK))) {
+                waitpid(slot->data.childpid, NULL, __WALL);
+            }
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    if (failed >= 0) {
+        trampoline_result(&slots[failed].data, slots[failed].outcome);
+        goto end;
+    }
+
+    result = PyList_New(count);
+    if (!result) {
+        goto end;
+    }
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        SpawnSlot *slot = &slots[index];
+        PyObject *elem = trampoline_result(&slot->data, slot->outcome);
+        if (!elem) {
+            // only building the tuple can fail, the remaining pidfds are closed
+            for (Py_ssize_t later = index + 1; later < count; ++later) {
+                if (slots[later].data.flags & (1 << ETD_PIDFD)) {
+                    close(slots[later].data.pidfd);
+                }
+            }
+            Py_CLEAR(result);
+            goto end;
+        }
+        PyList_SET_ITEM(result, index, elem);
+    }
+
+  end:
+    if (pipes) {
+        for (Py_ssize_t index = 0; index < 2 * count; ++index) {
+            if (pipes[index] >= 0) {
+                close(pipes[index]);
+            }
+        }
+    }
+    pyfree(pipes);
+    spawn_slots_free(slots, count);
+    Py_XDECREF(exec_specs);
+    cstring_array_clear(&exec_env);
+    cstring_array_clear(&exec_merged_env);
+    spawn_options_clear(&options);
+    return result;
+}
+
+
+typedef struct {
+    PyObject_HEAD
+    char *path;
+    char **argv;
+    char **envp;
+    int *pass_fds;
+    // owned cgroup descriptor, 0 if none (zeroed by tp_new)
+    int cgroup;
+    ExecTrampolineData data;
+} SpawnSpec;
+
+
+static int spawnspec_init(PyObject *self, PyObject *args, PyObject *kwargs) {
+    SpawnSpec *spec = (SpawnSpec*) self;
+    ModuleState *state = object_state(self);
+
+    int result = -1;
+    PyObject *exec_path = NULL;
+    CStringArray exec_args = { NULL, NULL };
+    CStringArray exec_env = { NULL, NULL };
+    CStringArray exec_merged_env = { NULL, NULL };
+    SpawnOptions options;
+    spawn_options_init(&options);
+
+    if (__atomic_load_n(&spec->argv, __ATOMIC_ACQUIRE)) {
+        // a spawn() of another thread may be using the frozen copies
+        PyErr_SetString(PyExc_ValueError, "SpawnSpec was initialized already");
+        return -1;
+    }
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs,
+            "O&"
+        "|" "O&" "O&"
+#if PY_VERSION_HEX >= 0x03030000
+        "$"
+#endif
+        SPAWN_OPTIONS_FORMAT
+        ":" "SpawnSpec",
+        (char**) cloneandexecve_keywords,
+        path_converter, &exec_path,
+        // |
+        cstring_array_converter, &exec_args,
+        cstring_array_converter, &exec_env,
+        // $
+        SPAWN_OPTIONS_CONVERTERS(&options)
+    )) {
+        goto end;
+    }
+
+    if (options.env_update && !environ_merge(state, exec_env.items, options.env_update, &exec_merged_env)) {
+        goto end;
+    }
+    char **env_source = options.env_update ? exec_merged_env.items : exec_env.items;
+
+    char *static_argv_list[] = { PyBytes_AS_STRING(exec_path), NULL };
+    ExecTrampolineData trampoline_data;
+    trampoline_data_init(&trampoline_data, NULL, NULL, NULL);
+    if (!spawn_options_apply(&options, &trampoline_data)) {
+        goto end;
+    }
+
+    char *frozen_path = cstring_copy(static_argv_list[0]);
+    char **frozen_argv = cstring_array_freeze(exec_args.items ? exec_args.items : static_argv_list);
+    char **frozen_envp = env_source ? cstring_array_freeze(env_source) : NULL;
+    if (!frozen_path || !frozen_argv || (env_source && !frozen_envp)) {
+        pyfree(frozen_path);
+        pyfree(frozen_argv);
+        pyfree(frozen_envp);
+        goto end;
+    }
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (spec->argv) {
+        // a concurrent __init__ was faster
+        PyErr_SetString(PyExc_ValueError, "SpawnSpec was initialized already");
+        pyfree(frozen_path);
+        pyfree(frozen_argv);
+        pyfree(frozen_envp);
+    } else {
+        spec->path = frozen_path;
+        spec->envp = frozen_envp;
+        // the template keeps the descriptor list and the cgroup it opened
+        spec->pass_fds = options.pass_fds.fds;
+        options.pass_fds.fds = NULL;
+        spec->cgroup = options.cgroup.owned ? options.cgroup.fd : 0;
+        options.cgroup.owned = false;
+        spec->data = trampoline_data;
+        spec->data.path = frozen_path;
+        spec->data.argv = frozen_argv;
+        spec->data.envp = frozen_envp;
+        // argv tells spawn() that the rest is set
+        __atomic_store_n(&spec->argv, frozen_argv, __ATOMIC_RELEASE);
+        result = 0;
+    }
+    Py_END_CRITICAL_SECTION();
+
+  end:
+    Py_XDECREF(exec_path);
+    cstring_array_clear(&exec_args);
+    cstring_array_clear(&exec_env);
+    cstring_array_clear(&exec_merged_env);
+    spawn_options_clear(&options);
+    return result;
+}
+
+
+static void spawnspec_dealloc(PyObject *self) {
+    SpawnSpec *spec = (SpawnSpec*) self;
+    pyfree(spec->path);
+    pyfree(spec->argv);
+    pyfree(spec->envp);
+    pyfree(spec->pass_fds);
+    if (spec->cgroup > 0) {
+        close(spec->cgroup);
+    }
+    object_free(self);
+}
+
+
+static PyObject *spawnspec_spawn_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    SpawnSpec *spec = (SpawnSpec*) self;
+    uint64_t prepare = stats_started();
+
+    // set once by __init__ and only freed with the object
+    char **spec_argv = __atomic_load_n(&spec->argv, __ATOMIC_ACQUIRE);
+    if (!spec_argv) {
+        PyErr_SetString(PyExc_ValueError, "SpawnSpec was not initialized");
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    PyObject *extra_args = NULL;
+    PyObject *resolved = NULL;
+    char **argv_list = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O&:spawn",
+        (char**) spawnspec_spawn_keywords,
+        bytes_list_converter, &extra_args
+    )) {
+        return NULL;
+    }
+
+    ExecTrampolineData trampoline_data = spec->data;
+    trampoline_data.stats_prepare = prepare;
+    if (trampoline_data.flags & (1 << ETD_SEARCH_PATH)) {
+        resolved = path_resolve(object_state(self), trampoline_data.path);
+        if (!resolved) {
+            goto end;
+        } else if (resolved != Py_None) {
+            trampoline_data.resolved = PyBytes_AS_STRING(resolved);
+        }
+    }
+    if (extra_args) {
+        Py_ssize_t argc = 0;
+        while (spec_argv[argc]) {
+            ++argc;
+        }
+        Py_ssize_t extra_count = PyList_GET_SIZE(extra_args);
+        argv_list = pymalloc(sizeof(char*) * (argc + extra_count + 1));
+        if (!argv_list) {
+            PyErr_NoMemory();
+            goto end;
+        }
+        memcpy(argv_list, spec_argv, sizeof(char*) * argc);
+        for (Py_ssize_t index = 0; index < extra_count; ++index) {
+            argv_list[argc + index] = PyBytes_AS_STRING(PyList_GET_ITEM(extra_args, index));
+        }
+        argv_list[argc + extra_count] = NULL;
+        trampoline_data.argv = argv_list;
+    }
+
+    int outcome;
+    Py_BEGIN_ALLOW_THREADS
+    outcome = trampoline_spawn(&trampoline_data);
+    Py_END_ALLOW_THREADS
+    result = trampoline_result(&trampoline_data, outcome);
+
+  end:
+    pyfree(argv_list);
+    Py_XDECREF(resolved);
+    Py_XDECREF(extra_args);
+    return result;
+}
+
+
+#ifdef HAVE_MODULE_STATE
+static PyType_Slot spawnspec_slots[] = {
+    { Py_tp_dealloc, spawnspec_dealloc },
+    { Py_tp_doc, (void*) spawnspec_doc },
+    { Py_tp_methods, spawnspec_methods_def },
+    { Py_tp_init, spawnspec_init },
+    { Py_tp_new, PyType_GenericNew },
+    { 0, NULL }
+};
+
+static PyType_Spec spawnspec_spec = {
+    "pdeathsignal.SpawnSpec",
+    sizeof(SpawnSpec),
+    0,
+    Py_TPFLAGS_DEFAULT | TYPE_FLAGS,
+    spawnspec_slots,
+};
+#else
+static PyTypeObject spawnspec_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pdeathsignal.SpawnSpec",
+    .tp_basicsize = sizeof(SpawnSpec),
+    .tp_dealloc = spawnspec_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = spawnspec_doc,
+    .tp_methods = spawnspec_methods_def,
+    .tp_init = spawnspec_init,
+    .tp_new = PyType_GenericNew,
+};
+#endif
+
+
+static int siginfo_to_status(const siginfo_t *info) {
+    switch (info->si_code) {
+    case CLD_EXITED:
+        return (info->si_status & 0xff) << 8;
+    case CLD_KILLED:
+        return info->si_status & 0x7f;
+    case CLD_DUMPED:
+        return (info->si_status & 0x7f) | 0x80;
+    default:
+        return 0;
+    }
+}
+
+
+typedef struct {
+    PyObject_HEAD
+    pid_t pgid;
+} Supervisor;
+
+
+// true if the group still has a child of this process, so its id cannot be reused
+static bool process_group_alive(pid_t pgid) {
+    if (pgid <= 0) {
+        return false;
+    }
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    return waitid(P_PGID, pgid, &info, WEXITED | WNOHANG | WNOWAIT | __WALL) == 0;
+}
+
+
+static bool process_group_prepare(pid_t *group, ExecTrampolineData *data) {
+    if (data->flags & ((1 << ETD_SETSID) | (1 << ETD_SIBLING))) {
+        PyErr_SetString(PyExc_ValueError, "A Supervisor cannot spawn with setsid or sibling");
+        return false;
+    }
+    if (!process_group_alive(*group)) {
+        // the first child starts a new group
+        *group = 0;
+    }
+    data->flags |= (1 << ETD_SETPGID);
+    data->pgid = *group;
+    return true;
+}
+
+
+static int supervisor_init(PyObject *self, PyObject *args, PyObject *kwargs) {
+    Supervisor *supervisor = (Supervisor*) self;
+
+    bool subreaper = true;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O&:Supervisor",
+        (char**) supervisor_keywords,
+        bool_false_converter, &subreaper
+    )) {
+        return -1;
+    }
+
+    if (subreaper && (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) != 0)) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    supervisor->pgid = 0;
+    return 0;
+}
+
+
+static PyObject *supervisor_spawn_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    Supervisor *supervisor = (Supervisor*) self;
+    uint64_t prepare = stats_started();
+    PyObject *result = NULL;
+    SpawnCall call;
+    spawn_call_init(&call);
+    if (spawn_call_parse(&call, args, kwargs, CLONEANDEXECVE_FORMAT("spawn"))) {
+        // the first spawn keeps the thread attached, so the section also covers the group creation
+        Py_BEGIN_CRITICAL_SECTION(self);
+        result = cloneandexecve_run(object_state(self), &call, &supervisor->pgid, prepare);
+        Py_END_CRITICAL_SECTION();
+    }
+    spawn_call_clear(&call);
+    return result;
+}
+
+
+// appends (pid, status) of the reaped children to result
+static bool supervisor_reap(Supervisor *supervisor, bool block, PyObject *result) {
+    while (supervisor->pgid > 0) {
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        int outcome;
+        Py_BEGIN_ALLOW_THREADS
+        outcome = waitid(P_PGID, supervisor->pgid, &info, WEXITED | __WALL | (block ? 0 : WNOHANG));
+        Py_END_ALLOW_THREADS
+
+        if (outcome != 0) {
+            if (errno == ECHILD) {
+                // the group is gone, or at least none of our business anymore
+                supervisor->pgid = 0;
+                break;
+            } else if (errno == EINTR) {
+                if (PyErr_CheckSignals() != 0) {
+                    return false;
+                }
+                continue;
+            }
+            PyErr_SetFromErrno(PyExc_OSError);
+            return false;
+        } else if (info.si_pid == 0) {
+            // WNOHANG and no child has exited yet
+            break;
+        }
+
+        PyObject *elem = Py_BuildValue("(ii)", (int) info.si_pid, siginfo_to_status(&info));
+        if (!elem) {
+            return false;
+        }
+        int appended = PyList_Append(result, elem);
+        Py_DECREF(elem);
+        if (appended != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static PyObject *supervisor_reap_all_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    Supervisor *supervisor = (Supervisor*) self;
+
+    bool block = false;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O&:reap_all",
+        (char**) supervisor_reap_all_keywords,
+        bool_false_converter, &block
+    )) {
+        return NULL;
+    }
+
+    PyObject *result = PyList_New(0);
+    if (result) {
+        bool success;
+        Py_BEGIN_CRITICAL_SECTION(self);
+        success = supervisor_reap(supervisor, block, result);
+        Py_END_CRITICAL_SECTION();
+        if (!success) {
+            Py_CLEAR(result);
+        }
+    }
+    return result;
+}
+
+
+static double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+
+#define SUPERVISOR_POLL_MAX 64
+
+
+// opens pidfds for the running children of this process in the group, at most capacity
+static int process_group_pidfds(pid_t pgid, int *pidfds, int capacity) {
+    int count = 0;
+    // a child is listed under the thread that created it, orphans under any
+    DIR *tasks = opendir("/proc/self/task");
+    if (!tasks) {
+        return 0;
+    }
+    struct dirent *task;
+    while ((count < capacity) && (task = readdir(tasks))) {
+        if (task->d_name[0] == '.') {
+            continue;
+        }
+        char path[sizeof("/proc/self/task//children") + NAME_MAX];
+        snprintf(path, sizeof(path), "/proc/self/task/%s/children", task->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        char buffer[1024];
+        pid_t pid = 0;
+        ssize_t length;
+        while ((count < capacity) && ((length = read(fd, buffer, sizeof(buffer))) > 0)) {
+            for (ssize_t index = 0; (index < length) && (count < capacity); ++index) {
+                if ((buffer[index] >= '0') && (buffer[index] <= '9')) {
+                    pid = pid * 10 + (buffer[index] - '0');
+                    continue;
+                } else if ((pid <= 0) || (getpgid(pid) != pgid)) {
+                    pid = 0;
+                    continue;
+                }
+                int pidfd = pidfd_open_raw(pid);
+                pid = 0;
+                if (pidfd < 0) {
+                    continue;
+                }
+                siginfo_t info;
+                memset(&info, 0, sizeof(info));
+                // the pid may have been reaped and reused since the listing
+                if (syscall(SYS_waitid, P_PIDFD, pidfd, &info, WEXITED | WNOHANG | WNOWAIT | __WALL, NULL) != 0) {
+                    close(pidfd);
+                    continue;
+                }
+                pidfds[count++] = pidfd;
+            }
+        }
+        close(fd);
+    }
+    closedir(tasks);
+    return count;
+}
+
+
+// waits without the GIL until a child in the group exits or the deadline passes, returns -1 with errno
+static int process_group_wait(pid_t pgid, double deadline) {
+    int pidfds[SUPERVISOR_POLL_MAX];
+    struct pollfd pollfds[SUPERVISOR_POLL_MAX];
+    int count = process_group_pidfds(pgid, pidfds, SUPERVISOR_POLL_MAX);
+    for (int index = 0; index < count; ++index) {
+        pollfds[index].fd = pidfds[index];
+        pollfds[index].events = POLLIN;
+        pollfds[index].revents = 0;
+    }
+    // without any pidfd, e.g. if /proc is not mounted, this sleeps until the deadline
+    double remaining = deadline - monotonic_seconds();
+    int timeout_ms = (remaining > 0.0) ? (int) (remaining * 1000.0 + 0.999) : 0;
+    int outcome = poll(pollfds, (nfds_t) count, timeout_ms);
+    int error = errno;
+    for (int index = 0; index < count; ++index) {
+        close(pidfds[index]);
+    }
+    errno = error;
+    return outcome;
+}
+
+
+static PyObject *supervisor_terminate(Supervisor *supervisor, int signum, double grace);
+
+
+static PyObject *supervisor_terminate_all_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    int signum = SIGTERM;
+    PyObject *grace_arg = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O&O:terminate_all",
+        (char**) supervisor_terminate_all_keywords,
+        signal_0_convert, &signum,
+        &grace_arg
+    )) {
+        return NULL;
+    }
+    double grace = -1.0;
+    if (grace_arg != Py_None) {
+        grace = PyFloat_AsDouble(grace_arg);
+        if ((grace == -1.0) && PyErr_Occurred()) {
+            return NULL;
+        } else if (grace < 0.0) {
+            PyErr_SetString(PyExc_ValueError, "grace must not be negative");
+            return NULL;
+        }
+    }
+
+    PyObject *result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = supervisor_terminate((Supervisor*) self, signum, grace);
+    Py_END_CRITICAL_SECTION();
+    return result;
+}
+
+
+static PyObject *supervisor_terminate(Supervisor *supervisor, int signum, double grace) {
+    PyObject *result = PyList_New(0);
+    if (!result) {
+        return NULL;
+    }
+    if (!process_group_alive(supervisor->pgid)) {
+        supervisor->pgid = 0;
+        return result;
+    }
+    if (kill(-supervisor->pgid, signum) != 0) {
+        Py_DECREF(result);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    if (!supervisor_reap(supervisor, false, result)) {
+        goto error;
+    }
+    if (grace < 0.0) {
+        return result;
+    }
+
+    double deadline = monotonic_seconds() + grace;
+    while (process_group_alive(supervisor->pgid) && (monotonic_seconds() < deadline)) {
+        int outcome;
+        Py_BEGIN_ALLOW_THREADS
+        outcome = process_group_wait(supervisor->pgid, deadline);
+        Py_END_ALLOW_THREADS
+        if (outcome < 0) {
+            if (errno != EINTR) {
+                PyErr_SetFromErrno(PyExc_OSError);
+                goto error;
+            } else if (PyErr_CheckSignals() != 0) {
+                goto error;
+            }
+        }
+        if (!supervisor_reap(supervisor, false, result)) {
+            goto error;
+        }
+    }
+    if (process_group_alive(supervisor->pgid)) {
+        if ((kill(-supervisor->pgid, SIGKILL) != 0) && (errno != ESRCH)) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            goto error;
+        }
+        if (!supervisor_reap(supervisor, true, result)) {
+            goto error;
+        }
+    }
+    return result;
+
+  error:
+    Py_DECREF(result);
+    return NULL;
+}
+
+
+static PyObject *supervisor_get_pgid(PyObject *self, void *closure) {
+    (void) closure;
+    Supervisor *supervisor = (Supervisor*) self;
+    if (supervisor->pgid <= 0) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromLong(supervisor->pgid);
+}
+
+
+#ifdef HAVE_MODULE_STATE
+static PyType_Slot supervisor_slots[] = {
+    { Py_tp_doc, (void*) supervisor_doc },
+    { Py_tp_methods, supervisor_methods_def },
+    { Py_tp_getset, supervisor_getset_def },
+    { Py_tp_init, supervisor_init },
+    { Py_tp_new, PyType_GenericNew },
+    { 0, NULL }
+};
+
+static PyType_Spec supervisor_spec = {
+    "pdeathsignal.Supervisor",
+    sizeof(Supervisor),
+    0,
+    Py_TPFLAGS_DEFAULT | TYPE_FLAGS,
+    supervisor_slots,
+};
+#else
+static PyTypeObject supervisor_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pdeathsignal.Supervisor",
+    .tp_basicsize = sizeof(Supervisor),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = supervisor_doc,
+    .tp_methods = supervisor_methods_def,
+    .tp_getset = supervisor_getset_def,
+    .tp_init = supervisor_init,
+    .tp_new = PyType_GenericNew,
+};
+#endif
+
+
+#define ZYGOTE_PAYLOAD_MAX (1 << 16)
+
+typedef struct {
+    int signal;
+    unsigned flags;
+    sigset_t sigign;
+} ZygoteRequest;
+
+typedef struct {
+    int pid;
+    int error;
+    char fun[32];
+} ZygoteReply;
+
+// sent over the second socket when the zygote reaps a worker spawned with pidfd=True
+typedef struct {
+    int pid;
+    int status;
+} ZygoteExit;
+
+typedef struct {
+    PyObject_HEAD
+    pid_t pid;
+    int sock;
+    int events;
+    PyThread_type_lock lock;
+    // taken by wait(), events is only closed with it held
+    PyThread_type_lock wait_lock;
+} Zygote;
+
+
+static void zygote_fork_prepare(void) {
+#if PY_VERSION_HEX >= 0x03070000
+    PyOS_BeforeFork();
+#endif
+}
+
+
+static void zygote_fork_parent(void) {
+#if PY_VERSION_HEX >= 0x03070000
+    PyOS_AfterFork_Parent();
+#endif
+}
+
+
+static void zygote_fork_child(void) {
+#if PY_VERSION_HEX >= 0x03070000
+    PyOS_AfterFork_Child();
+#else
+    PyOS_AfterFork();
+#endif
+}
+
+
+static int zygote_exit_code(PyObject *result) {
+    if (result) {
+        int code = 0;
+        if (PyLong_Check(result)) {
+            code = (int) (PyLong_AsLong(result) & 0xff);
+        }
+        Py_DECREF(result);
+        return code;
+    } else if (!PyErr_ExceptionMatches(PyExc_SystemExit)) {
+        PyErr_Print();
+        return 1;
+    }
+
+    // sys.exit() in the worker
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    PyObject *code = value ? PyObject_GetAttrString(value, "code") : NULL;
+    int exit_code = 1;
+    if (code && (code == Py_None)) {
+        exit_code = 0;
+    } else if (code && PyLong_Check(code)) {
+        exit_code = (int) (PyLong_AsLong(code) & 0xff);
+    }
+    Py_XDECREF(code);
+    Py_XDECREF(type);
+    Py_XDECREF(value);
+    Py_XDECREF(traceback);
+    PyErr_Clear();
+    return exit_code;
+}
+
+
+static void zygote_flush_stdio(void) {
+    const char *names[] = { "stdout", "stderr" };
+    for (int index = 0; index < 2; ++index) {
+        PyObject *stream = PySys_GetObject(names[index]);
+        if (stream && (stream != Py_None)) {
+            PyObject *result = PyObject_CallMethod(stream, "flush", NULL);
+            Py_XDECREF(result);
+        }
+    }
+    PyErr_Clear();
+}
+
+
+// runs in the forked worker, never returns
+static void zygote_worker(
+    int report, PyObject *target, const ZygoteRequest *request, const char *payload, size_t size,
+    const sigset_t *sigmask
+) {
+    // the zygote blocks SIGCHLD for its signalfd
+    sigprocmask(SIG_SETMASK, sigmask, NULL);
+    ZygoteReply status;
+    memset(&status, 0, sizeof(status));
+    const char *fun = NULL;
+    if ((request->flags & (1 << ETD_SETSID)) && (setsid() == (pid_t) -1)) {
+        fun = "setsid";
+    } else if ((request->signal > 0) && (prctl(PR_SET_PDEATHSIG, request->signal, 0, 0, 0) != 0)) {
+        fun = "PR_SET_PDEATHSIG";
+    } else if ((request->flags & (1 << ETD_SIGIGN)) && !signals_set_handler(&request->sigign, SIG_IGN)) {
+        fun = "signal";
+    }
+    if (fun) {
+        status.error = errno;
+        strncpy(status.fun, fun, sizeof(status.fun) - 1);
+    }
+    if (write(report, &status, sizeof(status)) != sizeof(status)) {
+        _exit(127);
+    }
+    close(report);
+    if (fun) {
+        _exit(127);
+    }
+
+    PyObject *arg = PyBytes_FromStringAndSize(payload, size);
+    PyObject *result = arg ? PyObject_CallFunctionObjArgs(target, arg, NULL) : NULL;
+    Py_XDECREF(arg);
+    int code = zygote_exit_code(result);
+    zygote_flush_stdio();
+    _exit(code);
+}
+
+
+static bool zygote_send_reply(int sock, const ZygoteReply *reply, int fd) {
+    struct iovec iov = { (void*) reply, sizeof(*reply) };
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    if (fd >= 0) {
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &message, MSG_NOSIGNAL) == (ssize_t) sizeof(*reply);
+}
+
+
+// the workers spawned with pidfd=True, until their status was sent
+typedef struct {
+    ZygoteExit *items;
+    size_t count;
+    size_t capacity;
+} ZygoteWorkers;
+
+
+static bool zygote_workers_add(ZygoteWorkers *workers, pid_t pid) {
+    if (workers->count == workers->capacity) {
+        size_t capacity = workers->capacity ? 2 * workers->capacity : 16;
+        ZygoteExit *items = PyMem_RawRealloc(workers->items, sizeof(ZygoteExit) * capacity);
+        if (!items) {
+            return false;
+        }
+        workers->items = items;
+        workers->capacity = capacity;
+    }
+    // the status is -1 while the worker runs
+    ZygoteExit worker = { pid, -1 };
+    workers->items[workers->count++] = worker;
+    return true;
+}
+
+
+static void zygote_reap(ZygoteWorkers *workers) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (size_t index = 0; index < workers->count; ++index) {
+            if (workers->items[index].pid == pid) {
+                workers->items[index].status = status;
+                break;
+            }
+        }
+    }
+}
+
+
+// returns whether statuses are left because the socket is full
+static bool zygote_send_exits(int events, ZygoteWorkers *workers) {
+    bool full = false;
+    size_t kept = 0;
+    for (size_t index = 0; index < workers->count; ++index) {
+        ZygoteExit *worker = &workers->items[index];
+        if (!full && (worker->status != -1)) {
+            if (send(events, worker, sizeof(*worker), MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) {
+                continue;
+            } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+                full = true;
+            } else {
+                // nobody waits for it any more
+                continue;
+            }
+        }
+        workers->items[kept++] = *worker;
+    }
+    workers->count = kept;
+    return full;
+}
+
+
+// runs in the forked zygote, never returns
+static void zygote_serve(int sock, int events, PyObject *target) {
+    char *buffer = PyMem_RawMalloc(sizeof(ZygoteRequest) + ZYGOTE_PAYLOAD_MAX);
+    if (!buffer) {
+        _exit(1);
+    }
+
+    // SIGCHLD wakes up the zygote to reap its workers and send their status
+    sigset_t sigmask;
+    sigset_t sigchld;
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    int children = -1;
+    if (sigprocmask(SIG_BLOCK, &sigchld, &sigmask) == 0) {
+        children = signalfd(-1, &sigchld, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (children < 0) {
+            sigprocmask(SIG_SETMASK, &sigmask, NULL);
+        }
+    }
+    ZygoteWorkers workers = { NULL, 0, 0 };
+
+    for (;;) {
+        zygote_reap(&workers);
+        bool full = zygote_send_exits(events, &workers);
+        struct pollfd ready[3] = {
+            { sock, POLLIN, 0 },
+            { children, POLLIN, 0 },
+            { full ? events : -1, POLLOUT, 0 },
+        };
+        // without the signalfd, wake up now and then to reap workers while idle
+        if (poll(ready, 3, (children >= 0) ? -1 : 1000) <= 0) {
+            continue;
+        }
+        if (ready[1].revents) {
+            struct signalfd_siginfo info;
+            while (read(children, &info, sizeof(info)) > 0) {
+            }
+        }
+        if (!ready[0].revents) {
+            continue;
+        }
+        ssize_t size = recv(sock, buffer, sizeof(ZygoteRequest) + ZYGOTE_PAYLOAD_MAX, 0);
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _exit(1);
+        } else if ((size == 0) || ((size_t) size < sizeof(ZygoteRequest))) {
+            // the parent closed its end
+            _exit(0);
+        }
+        const ZygoteRequest *request = (const ZygoteRequest*) buffer;
+
+        ZygoteReply reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.pid = -1;
+        int pidfd = -1;
+        int report[2];
+        if (pipe2(report, O_CLOEXEC) != 0) {
+            reply.error = errno;
+            strcpy(reply.fun, "pipe2");
+            zygote_send_reply(sock, &reply, -1);
+            continue;
+        }
+
+        zygote_fork_prepare();
+        pid_t pid = fork();
+        if (pid == 0) {
+            zygote_fork_child();
+            close(sock);
+            close(events);
+            if (children >= 0) {
+                close(children);
+            }
+            close(report[0]);
+            zygote_worker(
+                report[1], target, request,
+                buffer + sizeof(ZygoteRequest), size - sizeof(ZygoteRequest), &sigmask
+            );
+        }
+        zygote_fork_parent();
+        close(report[1]);
+
+        if (pid < 0) {
+            reply.error = errno;
+            strcpy(reply.fun, "fork");
+        } else {
+            reply.pid = pid;
+            // the worker is not reaped before this, so the pid cannot be reused
+            if ((request->flags & (1 << ETD_PIDFD)) && ((pidfd = pidfd_open_raw(pid)) < 0)) {
+                reply.error = errno;
+                strcpy(reply.fun, "pidfd_open");
+            } else if ((request->flags & (1 << ETD_PIDFD)) && !zygote_workers_add(&workers, pid)) {
+                reply.error = ENOMEM;
+                strcpy(reply.fun, "malloc");
+            } else {
+                // the worker reports whether its options could be applied
+                ZygoteReply status;
+                if (read(report[0], &status, sizeof(status)) == (ssize_t) sizeof(status)) {
+                    reply.error = status.error;
+                    memcpy(reply.fun, status.fun, sizeof(reply.fun));
+                } else {
+                    reply.error = EPIPE;
+                    strcpy(reply.fun, "fork");
+                }
+            }
+        }
+        close(report[0]);
+        zygote_send_reply(sock, &reply, reply.error ? -1 : pidfd);
+        if (pidfd >= 0) {
+            close(pidfd);
+        }
+    }
+}
+
+
+static int zygote_init(PyObject *self, PyObject *args, PyObject *kwargs) {
+    Zygote *zygote = (Zygote*) self;
+
+    PyObject *target = NULL;
+    int signum = SIGKILL;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|O&:Zygote",
+        (char**) zygote_keywords,
+        &target,
+        signal_0_convert, &signum
+    )) {
+        return -1;
+    }
+    if (!PyCallable_Check(target)) {
+        PyErr_SetString(PyExc_TypeError, "target must be callable");
+        return -1;
+#ifdef HAVE_MODULE_STATE
+    } else if (PyInterpreterState_Get() != PyInterpreterState_Main()) {
+        // the forked zygote would run the target with the other interpreters' state half copied
+        PyErr_SetString(PyExc_RuntimeError, "A Zygote can only be created in the main interpreter");
+        return -1;
+#endif
+    } else if (zygote->pid > 0) {
+        PyErr_SetString(PyExc_ValueError, "Zygote was initialized already");
+        return -1;
+    }
+
+    if (!zygote->lock) {
+        zygote->lock = PyThread_allocate_lock();
+        if (!zygote->lock) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    if (!zygote->wait_lock) {
+        zygote->wait_lock = PyThread_allocate_lock();
+        if (!zygote->wait_lock) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+
+    int sockets[2];
+    int events[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) != 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    } else if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, events) != 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        close(sockets[0]);
+        close(sockets[1]);
+        return -1;
+    }
+
+    pid_t parent = getpid();
+    zygote_fork_prepare();
+    pid_t pid = fork();
+    if (pid == 0) {
+        zygote_fork_child();
+        close(sockets[0]);
+        close(events[0]);
+        if ((signum > 0) && (prctl(PR_SET_PDEATHSIG, signum, 0, 0, 0) != 0)) {
+            _exit(1);
+        } else if (getppid() != parent) {
+            // the parent died before the death signal was set
+            _exit(1);
+        }
+        zygote_serve(sockets[1], events[1], target);
+    }
+    zygote_fork_parent();
+    close(sockets[1]);
+    close(events[1]);
+    if (pid < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        close(sockets[0]);
+        close(events[0]);
+        return -1;
+    }
+
+    zygote->pid = pid;
+    zygote->sock = sockets[0];
+    zygote->events = events[0];
+    return 0;
+}
+
+
+static void zygote_stop(Zygote *zygote) {
+    if (zygote->pid <= 0) {
+        return;
+    }
+    close(zygote->sock);
+    pid_t pid = zygote->pid;
+    zygote->pid = 0;
+    zygote->sock = -1;
+    // a concurrent wait() returns, then the socket can be closed
+    shutdown(zygote->events, SHUT_RDWR);
+    // the zygote exits as soon as it sees the closed socket
+    Py_BEGIN_ALLOW_THREADS
+    while ((waitpid(pid, NULL, 0) < 0) && (errno == EINTR)) {
+    }
+    PyThread_acquire_lock(zygote->wait_lock, WAIT_LOCK);
+    close(zygote->events);
+    zygote->events = -1;
+    PyThread_release_lock(zygote->wait_lock);
+    Py_END_ALLOW_THREADS
+}
+
+
+static void zygote_dealloc(PyObject *self) {
+    Zygote *zygote = (Zygote*) self;
+    zygote_stop(zygote);
+    if (zygote->lock) {
+        PyThread_free_lock(zygote->lock);
+    }
+    if (zygote->wait_lock) {
+        PyThread_free_lock(zygote->wait_lock);
+    }
+    object_free(self);
+}
+
+
+static PyObject *zygote_close_impl(PyObject *self, PyObject *no_args) {
+    (void) no_args;
+
+    Zygote *zygote = (Zygote*) self;
+    if (zygote->lock) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(zygote->lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+        zygote_stop(zygote);
+        PyThread_release_lock(zygote->lock);
+    }
+    Py_RETURN_NONE;
+}
+
+
+static ssize_t zygote_receive_reply(int sock, ZygoteReply *reply, int *fd) {
+    struct iovec iov = { reply, sizeof(*reply) };
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t size;
+    do {
+        size = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+    } while ((size < 0) && (errno == EINTR));
+
+    *fd = -1;
+    struct cmsghdr *header = (size > 0) ? CMSG_FIRSTHDR(&message) : NULL;
+    if (header && (header->cmsg_level == SOL_SOCKET) && (header->cmsg_type == SCM_RIGHTS)) {
+        memcpy(fd, CMSG_DATA(header), sizeof(int));
+    }
+    return size;
+}
+
+
+static PyObject *zygote_spawn_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    Zygote *zygote = (Zygote*) self;
+
+    Py_buffer payload = { NULL, NULL };
+    int signum = -1;
+    bool setsid_flag = false;
+    SignalSet sigign;
+    bool pidfd_flag = false;
+    sigemptyset(&sigign.set);
+    sigign.count = 0;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs,
+        "|" "y*"
+#if PY_VERSION_HEX >= 0x03030000
+        "$"
+#endif
+        "O&" "O&" "O&" "O&" ":spawn",
+        (char**) zygote_spawn_keywords,
+        &payload,
+        signal_m1_convert, &signum,
+        bool_false_converter, &setsid_flag,
+        signal_set_converter, &sigign,
+        bool_false_converter, &pidfd_flag
+    )) {
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    size_t payload_size = payload.buf ? (size_t) payload.len : 0;
+    char *message = NULL;
+    if (payload_size > ZYGOTE_PAYLOAD_MAX) {
+        PyErr_SetString(PyExc_ValueError, "payload is too large");
+        goto end;
+    }
+    message = pymalloc(sizeof(ZygoteRequest) + payload_size);
+    if (!message) {
+        PyErr_NoMemory();
+        goto end;
+    }
+    ZygoteRequest *request = (ZygoteRequest*) message;
+    memset(request, 0, sizeof(*request));
+    request->signal = signum;
+    request->flags = (
+        (setsid_flag ? (1 << ETD_SETSID) : 0) |
+        (sigign.count ? (1 << ETD_SIGIGN) : 0) |
+        (pidfd_flag ? (1 << ETD_PIDFD) : 0)
+    );
+    request->sigign = sigign.set;
+    if (payload_size) {
+        memcpy(message + sizeof(ZygoteRequest), payload.buf, payload_size);
+    }
+
+    if (!zygote->lock) {
+        PyErr_SetString(PyExc_ValueError, "Zygote was not initialized");
+        goto end;
+    }
+    ZygoteReply reply;
+    int pidfd = -1;
+    ssize_t sent = -1, received = -1;
+    int error = 0;
+    Py_BEGIN_ALLOW_THREADS
+    // one request at a time, the replies are not tagged
+    PyThread_acquire_lock(zygote->lock, WAIT_LOCK);
+    if (zygote->pid > 0) {
+        sent = send(zygote->sock, message, sizeof(ZygoteRequest) + payload_size, MSG_NOSIGNAL);
+        if (sent >= 0) {
+            received = zygote_receive_reply(zygote->sock, &reply, &pidfd);
+        }
+        error = errno;
+    } else {
+        error = EBADF;
+    }
+    PyThread_release_lock(zygote->lock);
+    Py_END_ALLOW_THREADS
+
+    if ((sent < 0) || (received < 0)) {
+        errno = error;
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto end;
+    } else if (received != sizeof(reply)) {
+        PyErr_SetString(PyExc_OSError, "The zygote has exited");
+        goto end;
+    } else if (reply.error) {
+        if (pidfd >= 0) {
+            close(pidfd);
+        }
+        char text[64];
+        reply.fun[sizeof(reply.fun) - 1] = '\0';
+        snprintf(text, sizeof(text), "zygote successful, but %s failed", reply.fun);
+        PyObject *value = Py_BuildValue("(is)", reply.error, text);
+        if (value) {
+            PyErr_SetObject(PyExc_OSError, value);
+            Py_DECREF(value);
+        }
+        goto end;
+    }
+
+    if (pidfd_flag) {
+        result = Py_BuildValue("(ii)", reply.pid, pidfd);
+        if (!result) {
+            close(pidfd);
+        }
+    } else {
+        if (pidfd >= 0) {
+            close(pidfd);
+        }
+        result = PyLong_FromLong(reply.pid);
+    }
+
+  end:
+    pyfree(message);
+    if (payload.buf) {
+        PyBuffer_Release(&payload);
+    }
+    return result;
+}
+
+
+static PyObject *zygote_wait_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    Zygote *zygote = (Zygote*) self;
+
+    PyObject *timeout = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O:wait",
+        (char**) zygote_wait_keywords,
+        &timeout
+    )) {
+        return NULL;
+    }
+    double deadline = 0.0;
+    if (timeout != Py_None) {
+        double seconds = PyFloat_AsDouble(timeout);
+        if ((seconds == -1.0) && PyErr_Occurred()) {
+            return NULL;
+        }
+        deadline = monotonic_seconds() + seconds;
+    }
+    if (!zygote->wait_lock) {
+        PyErr_SetString(PyExc_ValueError, "Zygote was not initialized");
+        return NULL;
+    }
+
+    ZygoteExit worker;
+    ssize_t received = -1;
+    for (;;) {
+        int timeout_ms = -1;
+        if (timeout != Py_None) {
+            double remaining = deadline - monotonic_seconds();
+            timeout_ms = (remaining > 0.0) ? (int) (remaining * 1000.0 + 0.999) : 0;
+        }
+        int outcome;
+        int error;
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(zygote->wait_lock, WAIT_LOCK);
+        if (zygote->events >= 0) {
+            struct pollfd ready = { zygote->events, POLLIN, 0 };
+            outcome = poll(&ready, 1, timeout_ms);
+            if (outcome > 0) {
+                received = recv(zygote->events, &worker, sizeof(worker), MSG_DONTWAIT);
+            }
+        } else {
+            outcome = -1;
+            errno = EBADF;
+        }
+        error = errno;
+        PyThread_release_lock(zygote->wait_lock);
+        Py_END_ALLOW_THREADS
+
+        if ((outcome < 0) || ((outcome > 0) && (received < 0))) {
+            if (error != EINTR) {
+                errno = error;
+                return PyErr_SetFromErrno(PyExc_OSError);
+            } else if (PyErr_CheckSignals() < 0) {
+                return NULL;
+            }
+        } else if (outcome > 0) {
+            break;
+        } else if (timeout_ms == 0) {
+            Py_RETURN_NONE;
+        }
+    }
+    if (received != sizeof(worker)) {
+        PyErr_SetString(PyExc_OSError, "The zygote has exited");
+        return NULL;
+    }
+    return Py_BuildValue("(ii)", worker.pid, worker.status);
+}
+
+
+static PyObject *zygote_get_pid(PyObject *self, void *closure) {
+    (void) closure;
+    Zygote *zygote = (Zygote*) self;
+    if (zygote->pid <= 0) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromLong(zygote->pid);
+}
+
+
+#ifdef HAVE_MODULE_STATE
+static PyType_Slot zygote_slots[] = {
+    { Py_tp_dealloc, zygote_dealloc },
+    { Py_tp_doc, (void*) zygote_doc },
+    { Py_tp_methods, zygote_methods_def },
+    { Py_tp_getset, zygote_getset_def },
+    { Py_tp_init, zygote_init },
+    { Py_tp_new, PyType_GenericNew },
+    { 0, NULL }
+};
+
+static PyType_Spec zygote_spec = {
+    "pdeathsignal.Zygote",
+    sizeof(Zygote),
+    0,
+    Py_TPFLAGS_DEFAULT | TYPE_FLAGS,
+    zygote_slots,
+};
+#else
+static PyTypeObject zygote_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pdeathsignal.Zygote",
+    .tp_basicsize = sizeof(Zygote),
+    .tp_dealloc = zygote_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = zygote_doc,
+    .tp_methods = zygote_methods_def,
+    .tp_getset = zygote_getset_def,
+    .tp_init = zygote_init,
+    .tp_new = PyType_GenericNew,
+};
+#endif
+
+
+typedef struct {
+    PyObject_HEAD
+    SpawnRequest request;
+    ExecTrampolineData data;
+    bool submitted;
+    bool completed;
+    // the pidfd was handed out by result()
+    bool returned;
+    // what result() returned first, it hands out the pidfd only once
+    PyObject *result;
+    int eventfd;
+    char *path;
+    char *resolved;
+    char **argv;
+    char **envp;
+    int *pass_fds;
+    // duplicated stdio and cgroup descriptors, -1 if none
+    int fds[4];
+} PendingSpawn;
+
+
+static void pending_spawn_release_fds(PendingSpawn *pending) {
+    for (int index = 0; index < 4; ++index) {
+        if (pending->fds[index] >= 0) {
+            close(pending->fds[index]);
+            pending->fds[index] = -1;
+        }
+    }
+}
+
+
+// waits up to timeout_ms, -1 is forever; returns false with an exception
+static bool pending_spawn_wait(PendingSpawn *pending, int timeout_ms, bool *completed) {
+    if (!pending->completed) {
+        struct pollfd pollfd = { pending->eventfd, POLLIN, 0 };
+        int outcome;
+        Py_BEGIN_ALLOW_THREADS
+        outcome = poll(&pollfd, 1, timeout_ms);
+        Py_END_ALLOW_THREADS
+        if (outcome < 0) {
+            if (errno != EINTR) {
+                PyErr_SetFromErrno(PyExc_OSError);
+                return false;
+            } else if (PyErr_CheckSignals() < 0) {
+                return false;
+            }
+        } else if (outcome > 0) {
+            Py_BEGIN_CRITICAL_SECTION((PyObject*) pending);
+            if (!pending->completed) {
+                // pairs with the fence of the spawner thread
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                pending->completed = true;
+                pending_spawn_release_fds(pending);
+            }
+            Py_END_CRITICAL_SECTION();
+        }
+    }
+    *completed = pending->completed;
+    return true;
+}
 
 
-static int signal_x_convert(PyObject *obj, int *result, int x) {
-    if (!obj || (obj == Py_None)) {
-        *result = x;
-        return true;
+static PyObject *cloneandexecve_nowait_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    ModuleState *state = module_state(self);
+    uint64_t prepare = stats_started();
+    PyObject *result = NULL;
+    PyObject *exec_path = NULL;
+    PyObject *exec_resolved = NULL;
+    CStringArray exec_args = { NULL, NULL };
+    CStringArray exec_env = { NULL, NULL };
+    CStringArray exec_merged_env = { NULL, NULL };
+    SpawnOptions options;
+    spawn_options_init(&options);
+
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, CLONEANDEXECVE_FORMAT("cloneandexecve_nowait"),
+        (char**) cloneandexecve_keywords,
+        path_converter, &exec_path,
+        // |
+        cstring_array_converter, &exec_args,
+        cstring_array_converter, &exec_env,
+        // $
+        SPAWN_OPTIONS_CONVERTERS(&options)
+    )) {
+        goto end;
+    }
+
+    if (options.env_update && !environ_merge(state, exec_env.items, options.env_update, &exec_merged_env)) {
+        goto end;
+    }
+    char **env_source = options.env_update ? exec_merged_env.items : exec_env.items;
+
+    PendingSpawn *pending = PyObject_New(PendingSpawn, state->pending_spawn_type);
+    if (!pending) {
+        goto end;
+    }
+    pending->submitted = false;
+    pending->completed = false;
+    pending->returned = false;
+    pending->result = NULL;
+    pending->eventfd = -1;
+    pending->path = NULL;
+    pending->resolved = NULL;
+    pending->argv = NULL;
+    pending->envp = NULL;
+    pending->pass_fds = NULL;
+    for (int index = 0; index < 4; ++index) {
+        pending->fds[index] = -1;
+    }
+    result = (PyObject*) pending;
+
+    char *static_argv_list[] = { PyBytes_AS_STRING(exec_path), NULL };
+    ExecTrampolineData *data = &pending->data;
+    trampoline_data_init(data, NULL, NULL, NULL);
+    if (!spawn_options_apply(&options, data)) {
+        goto fail;
+    }
+    if (options.search_path) {
+        exec_resolved = path_resolve(state, static_argv_list[0]);
+        if (!exec_resolved) {
+            goto fail;
+        } else if (exec_resolved != Py_None) {
+            pending->resolved = cstring_copy(PyBytes_AS_STRING(exec_resolved));
+            if (!pending->resolved) {
+                goto fail;
+            }
+        }
+    }
+
+    // the spawner thread reads all of this after the call returned
+    pending->path = cstring_copy(static_argv_list[0]);
+    pending->argv = cstring_array_freeze(exec_args.items ? exec_args.items : static_argv_list);
+    pending->envp = env_source ? cstring_array_freeze(env_source) : NULL;
+    if (!pending->path || !pending->argv || (env_source && !pending->envp)) {
+        goto fail;
+    }
+    data->path = pending->path;
+    data->resolved = pending->resolved;
+    data->argv = pending->argv;
+    data->envp = pending->envp;
+    pending->pass_fds = options.pass_fds.fds;
+    options.pass_fds.fds = NULL;
+    data->pass_fds = pending->pass_fds;
+    for (int target = 0; target < 4; ++target) {
+        int *fd = (target < 3) ? &data->stdio[target] : &data->cgroup;
+        if (*fd < 0) {
+            continue;
+        } else if ((target == 3) && options.cgroup.owned) {
+            options.cgroup.owned = false;
+            pending->fds[target] = *fd;
+            continue;
+        }
+        pending->fds[target] = fcntl(*fd, F_DUPFD_CLOEXEC, 3);
+        if (pending->fds[target] < 0) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            goto fail;
+        }
+        *fd = pending->fds[target];
+    }
+    if (!(data->flags & (1 << ETD_SIGMASK))) {
+        // as if this thread had spawned the child
+        pthread_sigmask(SIG_SETMASK, NULL, &data->sigmask);
+        data->flags |= (1 << ETD_SIGMASK);
+    }
+    data->stats_prepare = prepare;
+
+    pending->eventfd = eventfd(0, EFD_CLOEXEC);
+    if ((pending->eventfd < 0) || !spawner_start()) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto fail;
+    }
+    pending->request.data = data;
+    pending->request.outcome = -1;
+    pending->request.done = 0;
+    pending->request.eventfd = pending->eventfd;
+    pending->submitted = true;
+    spawner_submit(&pending->request);
+    goto end;
+
+  fail:
+    Py_CLEAR(result);
+
+  end:
+    Py_XDECREF(exec_resolved);
+    Py_XDECREF(exec_path);
+    cstring_array_clear(&exec_args);
+    cstring_array_clear(&exec_env);
+    cstring_array_clear(&exec_merged_env);
+    spawn_options_clear(&options);
+    return result;
+}
+
+
+static void pending_spawn_dealloc(PyObject *self) {
+    PendingSpawn *pending = (PendingSpawn*) self;
+    if (pending->submitted && !pending->completed) {
+        // the spawner thread still uses the data
+        struct pollfd pollfd = { pending->eventfd, POLLIN, 0 };
+        Py_BEGIN_ALLOW_THREADS
+        while ((poll(&pollfd, 1, -1) < 0) && (errno == EINTR)) {
+        }
+        Py_END_ALLOW_THREADS
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        pending->completed = true;
+    }
+    if (
+        pending->completed && !pending->returned && (pending->request.outcome == 0) &&
+        (pending->data.flags & (1 << ETD_PIDFD))
+    ) {
+        close(pending->data.pidfd);
+    }
+    pending_spawn_release_fds(pending);
+    if (pending->eventfd >= 0) {
+        close(pending->eventfd);
+    }
+    Py_XDECREF(pending->result);
+    pyfree(pending->path);
+    pyfree(pending->resolved);
+    pyfree(pending->argv);
+    pyfree(pending->envp);
+    pyfree(pending->pass_fds);
+    object_free(self);
+}
+
+
+static PyObject *pending_spawn_fileno_impl(PyObject *self, PyObject *no_args) {
+    (void) no_args;
+    return PyLong_FromLong(((PendingSpawn*) self)->eventfd);
+}
+
+
+static PyObject *pending_spawn_done_impl(PyObject *self, PyObject *no_args) {
+    (void) no_args;
+    bool completed;
+    if (!pending_spawn_wait((PendingSpawn*) self, 0, &completed)) {
+        return NULL;
+    }
+    return PyBool_FromLong(completed);
+}
+
+
+static PyObject *pending_spawn_result_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PendingSpawn *pending = (PendingSpawn*) self;
+
+    PyObject *timeout = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O:result",
+        (char**) pending_spawn_result_keywords,
+        &timeout
+    )) {
+        return NULL;
+    }
+    double deadline = 0.0;
+    if (timeout != Py_None) {
+        double seconds = PyFloat_AsDouble(timeout);
+        if ((seconds == -1.0) && PyErr_Occurred()) {
+            return NULL;
+        }
+        deadline = monotonic_seconds() + seconds;
+    }
+
+    bool completed = false;
+    for (;;) {
+        int timeout_ms = -1;
+        if (timeout != Py_None) {
+            double remaining = deadline - monotonic_seconds();
+            timeout_ms = (remaining > 0.0) ? (int) (remaining * 1000.0 + 0.999) : 0;
+        }
+        if (!pending_spawn_wait(pending, timeout_ms, &completed)) {
+            return NULL;
+        }
+        if (completed || (timeout_ms == 0)) {
+            break;
+        }
+    }
+    if (!completed) {
+#if PY_VERSION_HEX >= 0x03030000
+        PyErr_SetString(PyExc_TimeoutError, "The spawn is not done yet");
+#else
+        errno = ETIMEDOUT;
+        PyErr_SetFromErrno(PyExc_OSError);
+#endif
+        return NULL;
+    }
+
+    PyObject *result;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    if (pending->result) {
+        result = pending->result;
+        Py_INCREF(result);
+    } else if (pending->returned) {
+        // trampoline_result() closed the pidfd when it failed to build the tuple
+        PyErr_SetString(PyExc_RuntimeError, "The pidfd of the spawn was closed by an earlier result()");
+        result = NULL;
     } else {
-        return pylong_to_signum(obj, result);
+        result = trampoline_result(&pending->data, pending->request.outcome);
+        if ((pending->request.outcome == 0) && (pending->data.flags & (1 << ETD_PIDFD))) {
+            pending->returned = true;
+        }
+        if (result) {
+            pending->result = result;
+            Py_INCREF(result);
+        }
     }
+    Py_END_CRITICAL_SECTION();
+    return result;
 }
 
-static int signal_0_convert(PyObject *obj, int *result) {
-    return signal_x_convert(obj, result, 0);
+
+#ifdef HAVE_MODULE_STATE
+static PyType_Slot pending_spawn_slots[] = {
+    { Py_tp_dealloc, pending_spawn_dealloc },
+    { Py_tp_doc, (void*) pending_spawn_doc },
+    { Py_tp_methods, pending_spawn_methods_def },
+    { 0, NULL }
+};
+
+static PyType_Spec pending_spawn_spec = {
+    "pdeathsignal.PendingSpawn",
+    sizeof(PendingSpawn),
+    0,
+    Py_TPFLAGS_DEFAULT | TYPE_FLAGS_INTERNAL,
+    pending_spawn_slots,
+};
+#else
+static PyTypeObject pending_spawn_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pdeathsignal.PendingSpawn",
+    .tp_basicsize = sizeof(PendingSpawn),
+    .tp_dealloc = pending_spawn_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = pending_spawn_doc,
+    .tp_methods = pending_spawn_methods_def,
+};
+#endif
+
+
+static PyObject *backends_impl(PyObject *self, PyObject *no_args) {
+    (void) self;
+    (void) no_args;
+
+    PyObject *names[BACKEND_COUNT];
+    Py_ssize_t count = 0;
+    for (int backend = 0; backend < BACKEND_COUNT; ++backend) {
+        if ((backend == BACKEND_CLONE3) && !clone3_supported()) {
+            continue;
+        }
+        names[count] = PyUnicode_FromString(backend_names[backend]);
+        if (!names[count]) {
+            while (count > 0) {
+                Py_DECREF(names[--count]);
+            }
+            return NULL;
+        }
+        ++count;
+    }
+
+    PyObject *result = PyTuple_New(count);
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        if (result) {
+            PyTuple_SET_ITEM(result, index, names[index]);
+        } else {
+            Py_DECREF(names[index]);
+        }
+    }
+    return result;
 }
 
-static int signal_m1_convert(PyObject *obj, int *result) {
-    return signal_x_convert(obj, result, -1);
+
+static PyObject *refresh_environ_impl(PyObject *self, PyObject *no_args) {
+    (void) no_args;
+
+    ModuleState *state = module_state(self);
+    cache_lock(state);
+    Py_CLEAR(state->environ_snapshot);
+    unsigned long generation = ++state->environ_generation;
+    cache_unlock(state);
+    return PyLong_FromUnsignedLong(generation);
 }
 
 
-static int sigign_converter(PyObject *obj, uint64_t *result) {
-    if (!obj || (obj == Py_None)) {
-        *result = 0;
-        return true;
+static PyObject *clear_path_cache_impl(PyObject *self, PyObject *no_args) {
+    (void) no_args;
+
+    ModuleState *state = module_state(self);
+    cache_lock(state);
+    PyDict_Clear(state->path_cache);
+    cache_unlock(state);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *use_spawner_thread_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+
+    bool enabled = true;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O&:use_spawner_thread",
+        (char**) use_spawner_thread_keywords,
+        bool_false_converter, &enabled
+    )) {
+        return NULL;
     }
 
-    int truthy = PyObject_IsTrue(obj);
-    if (truthy < 0) {
-        return false;
-    } else if (!truthy) {
-        *result = 0;
-        return true;
+    if (enabled && !spawner_start()) {
+        return PyErr_SetFromErrno(PyExc_OSError);
     }
+    bool previous = __atomic_exchange_n(&spawner_enabled, enabled, __ATOMIC_RELEASE);
+    return PyBool_FromLong(previous);
+}
+
 
-    unsigned long long ull_value;
+// sys.executable -E -s -S -c "...", the module is imported from where it was loaded
+static char **helper_command(void) {
+    char **result = NULL;
+    PyObject *executable = NULL;
+    PyObject *module = NULL;
+    PyObject *file = NULL;
+    PyObject *directory = NULL;
+    PyObject *code = NULL;
+    PyObject *code_bytes = NULL;
+
+    PyObject *sys_executable = PySys_GetObject("executable");
+    if (!sys_executable || !PyObject_IsTrue(sys_executable)) {
+        PyErr_SetString(PyExc_RuntimeError, "sys.executable is not known");
+        goto end;
+    }
+    if (!path_converter(sys_executable, &executable)) {
+        goto end;
+    }
+    module = PyImport_ImportModule(module_name);
+    file = module ? PyObject_GetAttrString(module, "__file__") : NULL;
+    Py_XDECREF(module);
+    module = file ? PyImport_ImportModule("os.path") : NULL;
+    directory = module ? PyObject_CallMethod(module, "dirname", "O", file) : NULL;
+    if (!directory) {
+        goto end;
+    }
 #if PY_MAJOR_VERSION >= 3
-    ull_value = PyLong_AsUnsignedLongLong(obj);
+    code = PyUnicode_FromFormat(
+        "import sys; sys.path.insert(0, %R); import %s; %s._helper_main()",
+        directory, module_name, module_name
+    );
 #else
-    ull_value = PyInt_AsUnsignedLongLongMask(obj);
+    {
+        PyObject *repr = PyObject_Repr(directory);
+        code = repr ? PyString_FromFormat(
+            "import sys; sys.path.insert(0, %s); import %s; %s._helper_main()",
+            PyString_AS_STRING(repr), module_name, module_name
+        ) : NULL;
+        Py_XDECREF(repr);
+    }
 #endif
-    if ((ull_value == (unsigned long long) -1) && PyErr_Occurred()) {
-        if (!PyErr_ExceptionMatches(PyExc_TypeError)) {
-            return false;
+    code_bytes = code ? as_bytes(code) : NULL;
+    if (!code_bytes) {
+        goto end;
+    }
+
+    char *argv[] = {
+        PyBytes_AS_STRING(executable), "-E", "-s", "-S", "-c", PyBytes_AS_STRING(code_bytes),
+        HELPER_MARKER, NULL
+    };
+    result = cstring_array_freeze(argv);
+
+  end:
+    Py_XDECREF(executable);
+    Py_XDECREF(module);
+    Py_XDECREF(file);
+    Py_XDECREF(directory);
+    Py_XDECREF(code);
+    Py_XDECREF(code_bytes);
+    return result;
+}
+
+
+static PyObject *use_helper_process_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+
+    bool enabled = true;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O&:use_helper_process",
+        (char**) use_helper_process_keywords,
+        bool_false_converter, &enabled
+    )) {
+        return NULL;
+    }
+
+    // the helper itself starts with the first spawn
+    if (enabled) {
+        char **command = NULL;
+        if (!__atomic_load_n(&helper_argv, __ATOMIC_ACQUIRE)) {
+            command = helper_command();
+            if (!command) {
+                return NULL;
+            }
+        }
+        int error = 0;
+        pthread_mutex_lock(&setup_lock);
+        if (command && !helper_argv) {
+            // a concurrent call may have installed its command already
+            __atomic_store_n(&helper_argv, command, __ATOMIC_RELEASE);
+            command = NULL;
+        }
+        if (!helper_atfork_registered) {
+            error = pthread_atfork(NULL, NULL, helper_atfork_child);
+            helper_atfork_registered = error == 0;
+        }
+        if (!helper_connection_key_created && (error == 0)) {
+            error = pthread_key_create(&helper_connection_key, helper_connection_thread_exit);
+            helper_connection_key_created = error == 0;
+        }
+        pthread_mutex_unlock(&setup_lock);
+        pyfree(command);
+        if (error != 0) {
+            errno = error;
+            return PyErr_SetFromErrno(PyExc_OSError);
         }
-        PyErr_Clear();
-    } else if ((ull_value & ((uint64_t) -1)) == ull_value) {
-        *result = ull_value & ((uint64_t) -1);
-        return true;
-    } else {
-        // impossible unless sizeof(long long) != 64 bits
-        PyErr_SetNone(PyExc_OverflowError);
-        return false;
     }
 
-    uint64_t accu = 0;
-    bool success = false;
-    PyObject *iterator = PyObject_GetIter(obj);
-    if (!iterator) {
-        return false;
+    bool previous = __atomic_exchange_n(&helper_enabled, enabled, __ATOMIC_RELEASE);
+    if (!enabled) {
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&helper_lock);
+        helper_stop(false);
+        pthread_mutex_unlock(&helper_lock);
+        Py_END_ALLOW_THREADS
+    }
+    return PyBool_FromLong(previous);
+}
+
+
+static PyObject *set_spawn_stats_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+
+    bool enabled = false;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O&:set_spawn_stats",
+        (char**) set_spawn_stats_keywords,
+        bool_false_converter, &enabled
+    )) {
+        return NULL;
+    }
+
+    bool previous = __atomic_exchange_n(&spawn_stats_enabled, enabled, __ATOMIC_RELAXED);
+    return PyBool_FromLong(previous);
+}
+
+
+static int stats_dict_set(PyObject *dict, const char *key, PyObject *value) {
+    if (!value) {
+        return -1;
+    }
+    int result = PyDict_SetItemString(dict, key, value);
+    Py_DECREF(value);
+    return result;
+}
+
+
+static uint64_t stats_percentile(const uint64_t *buckets, uint64_t count, unsigned percent) {
+    if (!count) {
+        return 0;
+    }
+    uint64_t rank = (count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < STATS_BUCKETS; ++bucket) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            return (uint64_t) 1 << bucket;
+        }
+    }
+    return (uint64_t) 1 << (STATS_BUCKETS - 1);
+}
+
+
+static PyObject *stats_phase_dict(StatsPhase *stats) {
+    uint64_t buckets[STATS_BUCKETS];
+    uint64_t count = 0;
+    for (int bucket = 0; bucket < STATS_BUCKETS; ++bucket) {
+        buckets[bucket] = __atomic_load_n(&stats->buckets[bucket], __ATOMIC_RELAXED);
+        count += buckets[bucket];
+    }
+
+    PyObject *result = PyDict_New();
+    PyObject *histogram = PyTuple_New(STATS_BUCKETS);
+    if (!result || !histogram) {
+        Py_XDECREF(result);
+        Py_XDECREF(histogram);
+        return NULL;
+    }
+    for (int bucket = 0; bucket < STATS_BUCKETS; ++bucket) {
+        PyObject *value = PyLong_FromUnsignedLongLong(buckets[bucket]);
+        if (!value) {
+            Py_DECREF(histogram);
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(histogram, bucket, value);
+    }
+
+    if (
+        (stats_dict_set(result, "histogram", histogram) != 0) ||
+        (stats_dict_set(result, "count", PyLong_FromUnsignedLongLong(count)) != 0) ||
+        (stats_dict_set(result, "total_ns", PyLong_FromUnsignedLongLong(
+            __atomic_load_n(&stats->total, __ATOMIC_RELAXED)
+        )) != 0) ||
+        (stats_dict_set(result, "max_ns", PyLong_FromUnsignedLongLong(
+            __atomic_load_n(&stats->max, __ATOMIC_RELAXED)
+        )) != 0) ||
+        (stats_dict_set(result, "p50_ns", PyLong_FromUnsignedLongLong(
+            stats_percentile(buckets, count, 50)
+        )) != 0) ||
+        (stats_dict_set(result, "p99_ns", PyLong_FromUnsignedLongLong(
+            stats_percentile(buckets, count, 99)
+        )) != 0)
+    ) {
+        Py_DECREF(result);
+        return NULL;
+    }
+    return result;
+}
+
+
+static void stats_reset(void) {
+    __atomic_store_n(&spawn_stats.spawns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&spawn_stats.failures, 0, __ATOMIC_RELAXED);
+    for (int index = 0; index < STATS_FUNS; ++index) {
+        __atomic_store_n(&spawn_stats.fun_failures[index], 0, __ATOMIC_RELAXED);
+    }
+    for (int phase = 0; phase < STATS_PHASE_COUNT; ++phase) {
+        StatsPhase *stats = &spawn_stats.phases[phase];
+        __atomic_store_n(&stats->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->max, 0, __ATOMIC_RELAXED);
+        for (int bucket = 0; bucket < STATS_BUCKETS; ++bucket) {
+            __atomic_store_n(&stats->buckets[bucket], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+static PyObject *get_spawn_stats_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+
+    bool reset = false;
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|O&:get_spawn_stats",
+        (char**) get_spawn_stats_keywords,
+        bool_false_converter, &reset
+    )) {
+        return NULL;
+    }
+
+    PyObject *result = PyDict_New();
+    PyObject *funs = PyDict_New();
+    PyObject *phases = PyDict_New();
+    if (!result || !funs || !phases) {
+        goto error;
+    }
+
+    for (int index = 0; index < STATS_FUNS; ++index) {
+        const char *fun = __atomic_load_n(&spawn_stats.funs[index], __ATOMIC_ACQUIRE);
+        uint64_t failures = __atomic_load_n(&spawn_stats.fun_failures[index], __ATOMIC_RELAXED);
+        if (fun && failures && (stats_dict_set(funs, fun, PyLong_FromUnsignedLongLong(failures)) != 0)) {
+            goto error;
+        }
+    }
+    for (int phase = 0; phase < STATS_PHASE_COUNT; ++phase) {
+        if (stats_dict_set(phases, stats_phase_names[phase], stats_phase_dict(&spawn_stats.phases[phase])) != 0) {
+            goto error;
+        }
+    }
+
+    if (
+        (stats_dict_set(result, "spawns", PyLong_FromUnsignedLongLong(
+            __atomic_load_n(&spawn_stats.spawns, __ATOMIC_RELAXED)
+        )) != 0) ||
+        (stats_dict_set(result, "failures", PyLong_FromUnsignedLongLong(
+            __atomic_load_n(&spawn_stats.failures, __ATOMIC_RELAXED)
+        )) != 0)
+    ) {
+        goto error;
+    }
+    int outcome = stats_dict_set(result, "failures_by_fun", funs);
+    funs = NULL;
+    if (outcome != 0) {
+        goto error;
+    }
+    outcome = stats_dict_set(result, "phases", phases);
+    phases = NULL;
+    if (outcome != 0) {
+        goto error;
+    }
+
+    if (reset) {
+        stats_reset();
+    }
+    return result;
+
+  error:
+    Py_XDECREF(result);
+    Py_XDECREF(funs);
+    Py_XDECREF(phases);
+    return NULL;
+}
+
+
+typedef struct {
+    pid_t pid;
+    // -1 if none, the child is polled with WNOHANG then
+    int pidfd;
+    // the pidfd was opened by reap()
+    bool owned;
+    bool done;
+    bool reaped;
+    int status;
+    int64_t duration_us;
+    struct rusage usage;
+} ReapEntry;
+
+
+// reaps the exited children, returns how many are still running, or -1 with errno
+static Py_ssize_t reap_collect(ReapEntry *entries, Py_ssize_t count) {
+    Py_ssize_t running = 0;
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        ReapEntry *entry = &entries[index];
+        if (entry->done) {
+            continue;
+        }
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        long outcome;
+        // glibc's waitid() does not return the rusage
+        if (entry->pidfd >= 0) {
+            outcome = syscall(SYS_waitid, P_PIDFD, entry->pidfd, &info, WEXITED | WNOHANG | __WALL, &entry->usage);
+        } else {
+            outcome = syscall(SYS_waitid, P_PID, entry->pid, &info, WEXITED | WNOHANG | __WALL, &entry->usage);
+        }
+        if (outcome < 0) {
+            if (errno != ECHILD) {
+                return -1;
+            }
+            // not ours, or reaped already
+            entry->done = true;
+            continue;
+        } else if (info.si_pid == 0) {
+            ++running;
+            continue;
+        }
+        entry->done = true;
+        entry->reaped = true;
+        entry->status = siginfo_to_status(&info);
+        entry->duration_us = spawn_time_take(entry->pid, spawn_time_now());
     }
-    PyObject *(*iternext)(PyObject *) = *Py_TYPE(iterator)->tp_iternext;
+    return running;
+}
+
+
+// waits for the children without the GIL until the deadline, if any; returns false with errno
+static bool reap_wait(ReapEntry *entries, Py_ssize_t count, struct pollfd *pollfds, double deadline) {
+    // for the children without a pidfd
+    int delay_ms = 1;
     for (;;) {
-        PyObject *elem = iternext(iterator);
-        if (!elem) {
-            if (PyErr_Occurred()) {
-                if (!PyErr_ExceptionMatches(PyExc_StopIteration)) {
-                    success = false;
-                    break;
-                }
-                PyErr_Clear();
-            }
-            success = true;
-            break;
+        Py_ssize_t running = reap_collect(entries, count);
+        if (running < 0) {
+            return false;
+        } else if (running == 0) {
+            return true;
         }
 
-        int signum;
-        success = pylong_to_signum(elem, &signum);
-        Py_DECREF(elem);
-        if (!success) {
-            break;
+        int timeout_ms = -1;
+        if (deadline >= 0.0) {
+            double remaining = deadline - monotonic_seconds();
+            if (remaining <= 0.0) {
+                return true;
+            }
+            timeout_ms = (int) (remaining * 1000.0 + 0.999);
         }
-        if (signum > 0) {
-            accu |= 1 << (signum - 1);
+        nfds_t polled = 0;
+        for (Py_ssize_t index = 0; index < count; ++index) {
+            if (!entries[index].done && (entries[index].pidfd >= 0)) {
+                pollfds[polled].fd = entries[index].pidfd;
+                pollfds[polled].events = POLLIN;
+                pollfds[polled].revents = 0;
+                ++polled;
+            }
+        }
+        if (polled < (nfds_t) running) {
+            if ((timeout_ms < 0) || (timeout_ms > delay_ms)) {
+                timeout_ms = delay_ms;
+            }
+            if (delay_ms < 50) {
+                delay_ms *= 2;
+            }
+        }
+        if (poll(pollfds, polled, timeout_ms) < 0) {
+            return false;
         }
     }
+}
 
-    Py_DECREF(iterator);
-    if (success) {
-        *result = accu;
+
+static PyObject *reap_record(const ReapEntry *entry) {
+    const struct rusage *usage = &entry->usage;
+    PyObject *duration;
+    if (entry->duration_us >= 0) {
+        duration = PyFloat_FromDouble((double) entry->duration_us * 1e-6);
+    } else {
+        Py_INCREF(Py_None);
+        duration = Py_None;
     }
-    return success;
+    return Py_BuildValue(
+        "{s:i,s:i,s:d,s:d,s:l,s:l,s:l,s:l,s:l,s:l,s:l,s:N}",
+        "pid", (int) entry->pid,
+        "status", entry->status,
+        "utime", (double) usage->ru_utime.tv_sec + (double) usage->ru_utime.tv_usec * 1e-6,
+        "stime", (double) usage->ru_stime.tv_sec + (double) usage->ru_stime.tv_usec * 1e-6,
+        "maxrss", usage->ru_maxrss,
+        "minflt", usage->ru_minflt,
+        "majflt", usage->ru_majflt,
+        "inblock", usage->ru_inblock,
+        "oublock", usage->ru_oublock,
+        "nvcsw", usage->ru_nvcsw,
+        "nivcsw", usage->ru_nivcsw,
+        "duration", duration
+    );
 }
 
 
-static PyObject *getpdeathsignal_impl(PyObject *self, PyObject *no_args) {
-    (void) self;
-    (void) no_args;
+static bool reap_entry_init(ReapEntry *entry, PyObject *child) {
+    memset(entry, 0, sizeof(*entry));
+    entry->pidfd = -1;
+    entry->duration_us = -1;
 
-    int signal = -1;
-    int outcome = prctl(
-        PR_GET_PDEATHSIG,
-        (unsigned long) (uintptr_t) &signal,
-        0, 0, 0
-    );
-    return int_or_errno(outcome == 0, signal);
+    PyObject *pid = child;
+    if (PyTuple_Check(child)) {
+        if (PyTuple_GET_SIZE(child) != 2) {
+            PyErr_SetString(PyExc_ValueError, "Expected a pid or a (pid, pidfd) tuple");
+            return false;
+        }
+        pid = PyTuple_GET_ITEM(child, 0);
+        entry->pidfd = PyObject_AsFileDescriptor(PyTuple_GET_ITEM(child, 1));
+        if (entry->pidfd < 0) {
+            return false;
+        } else if (fcntl(entry->pidfd, F_GETFD) < 0) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            return false;
+        }
+    }
+    long value = PyLong_AsLong(pid);
+    if ((value == -1) && PyErr_Occurred()) {
+        return false;
+    } else if ((value <= 0) || (value > INT_MAX)) {
+        PyErr_SetString(PyExc_ValueError, "pid out of range");
+        return false;
+    }
+    entry->pid = (pid_t) value;
+    if (entry->pidfd < 0) {
+        // a child that is not ours, or without pidfd support, is polled
+        entry->pidfd = pidfd_open_raw(entry->pid);
+        entry->owned = entry->pidfd >= 0;
+    }
+    return true;
 }
 
 
-static PyObject *setpdeathsignal_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+static PyObject *reap_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
     (void) self;
 
-    int signal = 0;
+    PyObject *children = NULL;
+    PyObject *timeout_arg = Py_None;
     if (!PyArg_ParseTupleAndKeywords(
-        args, kwargs, "|O&:setpdeathsignal",
-        (char**) setpdeathsignal_keywords,
-        signal_0_convert, &signal
+        args, kwargs, "O|O:reap",
+        (char**) reap_keywords,
+        &children,
+        &timeout_arg
     )) {
         return NULL;
     }
-
-    int outcome = prctl(
-        PR_SET_PDEATHSIG,
-        signal,
-        0, 0, 0
-    );
-    if (outcome == 0) {
-        Py_RETURN_NONE;
-    } else {
-        return PyErr_SetFromErrno(PyExc_OSError);
+    double deadline = -1.0;
+    if (timeout_arg != Py_None) {
+        double timeout = PyFloat_AsDouble(timeout_arg);
+        if ((timeout == -1.0) && PyErr_Occurred()) {
+            return NULL;
+        } else if (timeout < 0.0) {
+            PyErr_SetString(PyExc_ValueError, "timeout must not be negative");
+            return NULL;
+        }
+        deadline = monotonic_seconds() + timeout;
     }
-}
-
-
-enum {
-    ETD_SEARCH_PATH,
-    ETD_SETSID,
-    ETD_DOUBLEFORK,
-};
-
-typedef struct {
-    char *path;
-    char **argv;
-    char **envp;
-    unsigned flags;
-    int parent_signal;
-    uint64_t sigign;
-    int childpid;
-    char *fun;
-    int error;
-} ExecTrampolineData;
 
+    PyObject *result = NULL;
+    ReapEntry *entries = NULL;
+    struct pollfd *pollfds = NULL;
+    Py_ssize_t count = 0;
+    PyObject *sequence = PySequence_Fast(children, "children must be iterable");
+    if (!sequence) {
+        return NULL;
+    }
 
-static int exec_trampoline(void *arg) {
-    ExecTrampolineData *data = (ExecTrampolineData*) arg;
-    char *fun = NULL;
+    Py_ssize_t length = PySequence_Fast_GET_SIZE(sequence);
+    entries = pymalloc(sizeof(ReapEntry) * (length ? length : 1));
+    pollfds = pymalloc(sizeof(struct pollfd) * (length ? length : 1));
+    if (!entries || !pollfds) {
+        PyErr_NoMemory();
+        goto end;
+    }
+    for (; count < length; ++count) {
+        if (!reap_entry_init(&entries[count], PySequence_Fast_GET_ITEM(sequence, count))) {
+            goto end;
+        }
+    }
 
-    if (data->flags & (1 << ETD_SETSID)) {
-        data->flags &= ~(1 << ETD_SETSID);
-        pid_t outcome = setsid();
-        if (outcome == (pid_t) -1) {
-            fun = "setsid";
-            goto fail;
+    for (;;) {
+        bool success;
+        int error;
+        Py_BEGIN_ALLOW_THREADS
+        success = reap_wait(entries, count, pollfds, deadline);
+        error = errno;
+        Py_END_ALLOW_THREADS
+        if (success) {
+            break;
+        } else if (error != EINTR) {
+            errno = error;
+            PyErr_SetFromErrno(PyExc_OSError);
+            break;
+        } else if (PyErr_CheckSignals() != 0) {
+            break;
         }
     }
 
-    int parent_signal = data->parent_signal;
-    if (parent_signal >= 0) {
-        data->parent_signal = 0;
-        int outcome = prctl(PR_SET_PDEATHSIG, parent_signal, 0, 0, 0);
-        if (outcome != 0) {
-            fun = "PR_SET_PDEATHSIG";
-            goto fail;
+    if (PyErr_Occurred()) {
+        goto end;
+    }
+
+    result = PyList_New(0);
+    for (Py_ssize_t index = 0; result && (index < count); ++index) {
+        if (!entries[index].reaped) {
+            continue;
         }
+        PyObject *record = reap_record(&entries[index]);
+        if (!record || (PyList_Append(result, record) != 0)) {
+            Py_CLEAR(result);
+        }
+        Py_XDECREF(record);
     }
 
-    if (data->flags & (1 << ETD_DOUBLEFORK)) {
-        data->flags &= ~(1 << ETD_DOUBLEFORK);
-        char child_stack[1 << 10];
-        int childprocess = clone(exec_trampoline, child_stack + sizeof(child_stack), CLONE_VFORK | CLONE_VM, data);
-        if (childprocess < 0) {
-            fun = "clone(doublefork)";
+  end:
+    for (Py_ssize_t index = 0; index < count; ++index) {
+        if (entries[index].owned) {
+            close(entries[index].pidfd);
         }
-        goto fail;
     }
+    pyfree(entries);
+    pyfree(pollfds);
+    Py_DECREF(sequence);
+    return result;
+}
 
-    uint64_t sigign = data->sigign;
-    if (sigign) {
-        data->sigign = 0;
-        int signum = 0;
-        do {
-            bool has = ((sigign & 1) == 1);
-            sigign >>= 1;
-            ++signum;
 
-            if (!has || (signum == SIGKILL) || (signum == SIGSTOP)) {
-                continue;
-            }
+#if PY_VERSION_HEX >= 0x03070000
+// state of wait_async(): (loop, future, pidfd)
+static PyObject *wait_async_remove_reader(PyObject *state) {
+    PyObject *loop = PyTuple_GET_ITEM(state, 0);
+    PyObject *pidfd = PyTuple_GET_ITEM(state, 2);
+    return PyObject_CallMethod(loop, "remove_reader", "O", pidfd);
+}
 
-            sighandler_t outcome = signal(signum, SIG_IGN);
-            if (outcome == SIG_ERR) {
-                fun = "signal";
-                goto fail;
-            }
-        } while (sigign);
+
+static PyObject *wait_async_on_readable(PyObject *state, PyObject *no_args) {
+    (void) no_args;
+
+    PyObject *future = PyTuple_GET_ITEM(state, 1);
+    int pidfd = (int) PyLong_AsLong(PyTuple_GET_ITEM(state, 2));
+
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    int outcome = waitid(P_PIDFD, (id_t) pidfd, &info, WEXITED | WNOHANG);
+    PyObject *value;
+    const char *method;
+    if (outcome < 0) {
+        method = "set_exception";
+        value = PyObject_CallFunction(PyExc_OSError, "is", errno, strerror(errno));
+    } else if (info.si_pid == 0) {
+        // spurious wakeup
+        Py_RETURN_NONE;
+    } else {
+        method = "set_result";
+        value = PyLong_FromLong(siginfo_to_status(&info));
+    }
+    if (!value) {
+        return NULL;
     }
 
-    data->childpid = getpid();
+    PyObject *removed = wait_async_remove_reader(state);
+    if (!removed) {
+        Py_DECREF(value);
+        return NULL;
+    }
+    Py_DECREF(removed);
 
-    if (data->envp) {
-        if (data->flags & (1 << ETD_SEARCH_PATH)) {
-            execvpe(data->path,  data->argv, data->envp);
-            fun = "execvpe";
-        } else {
-            execve(data->path, data->argv, data->envp);
-            fun = "execve";
-        }
+    PyObject *done = PyObject_CallMethod(future, "done", NULL);
+    int is_done = done ? PyObject_IsTrue(done) : -1;
+    Py_XDECREF(done);
+    if (is_done < 0) {
+        Py_DECREF(value);
+        return NULL;
+    }
+
+    PyObject *result;
+    if (is_done) {
+        Py_INCREF(Py_None);
+        result = Py_None;
     } else {
-        if (data->flags & (1 << ETD_SEARCH_PATH)) {
-            execvp(data->path, data->argv);
-            fun = "execvp";
-        } else {
-            execv(data->path, data->argv);
-            fun = "execv";
-        }
+        result = PyObject_CallMethod(future, method, "O", value);
     }
+    Py_DECREF(value);
+    return result;
+}
 
-  fail:
-    data->fun = fun;
-    data->error = errno;
-    raise(SIGKILL);
-    return -1;
+
+static PyObject *wait_async_on_done(PyObject *state, PyObject *future) {
+    (void) future;
+    // the future might have been cancelled
+    return wait_async_remove_reader(state);
 }
 
 
-static PyObject *cloneandexecve_impl(PyObject *self, PyObject *args, PyObject *kwargs) {
+static PyMethodDef wait_async_on_readable_def = {
+    "_on_readable", (PyCFunction) wait_async_on_readable, METH_NOARGS, NULL
+};
+
+static PyMethodDef wait_async_on_done_def = {
+    "_on_done", (PyCFunction) wait_async_on_done, METH_O, NULL
+};
+
+
+static PyObject *wait_async_impl(PyObject *self, PyObject *pidfd) {
     (void) self;
 
     PyObject *result = NULL;
-    PyObject *exec_path = NULL;
-    PyObject *exec_args = NULL;
-    PyObject *exec_env = NULL;
-    int exec_signal = -1;
-    bool exec_sibling = false;
-    bool exec_search_path = false;
-    bool exec_setsid = false;
-    bool exec_doublefork = false;
-    uint64_t exec_sigign = 0;
-    char **argv_list = NULL;
-    char **envp_list = NULL;
+    PyObject *asyncio = NULL;
+    PyObject *loop = NULL;
+    PyObject *future = NULL;
+    PyObject *state = NULL;
+    PyObject *on_readable = NULL;
+    PyObject *on_done = NULL;
+    PyObject *outcome = NULL;
 
-    if (!PyArg_ParseTupleAndKeywords(
-        args, kwargs,
-            "O&"
-        "|" "O&" "O&"
-#if PY_VERSION_HEX >= 0x03030000
-        "$"
-#endif
-        "O&" "O&" "O&" "O&" "O&" "O&"
-        ":" "cloneandexecve",
-        (char**) cloneandexecve_keywords,
-        path_converter, &exec_path,
-        // |
-        bytes_list_converter, &exec_args,
-        bytes_list_converter, &exec_env,
-        // $
-        signal_m1_convert, &exec_signal,
-        bool_false_converter, &exec_sibling,
-        bool_false_converter, &exec_search_path,
-        bool_false_converter, &exec_setsid,
-        bool_false_converter, &exec_doublefork,
-        sigign_converter, &exec_sigign
-    )) {
+    int fd = PyObject_AsFileDescriptor(pidfd);
+    if (fd < 0) {
         return NULL;
     }
 
-    argv_list = bytes_list_to_cstring_array(exec_args);
-    if (!argv_list && PyErr_Occurred()) {
+    asyncio = PyImport_ImportModule("asyncio");
+    if (!asyncio) {
         goto end;
     }
-
-    envp_list = bytes_list_to_cstring_array(exec_env);
-    if (!envp_list && PyErr_Occurred()) {
+    loop = PyObject_CallMethod(asyncio, "get_running_loop", NULL);
+    if (!loop) {
         goto end;
     }
-
-    const char *static_argv_list[] = { PyBytes_AS_STRING(exec_path), NULL };
-    char child_stack[1 << 11];
-    ExecTrampolineData trampoline_data = {
-        (char*) static_argv_list[0],
-        (argv_list ? (char**) argv_list : (char**) static_argv_list),
-        envp_list,
-        (
-            (exec_search_path ? (1 << ETD_SEARCH_PATH) : 0) |
-            (exec_setsid ? (1 << ETD_SETSID) : 0) |
-            (exec_doublefork ? (1 << ETD_DOUBLEFORK) : 0) |
-            0
-        ),
-        exec_signal,
-        exec_sigign,
-        -1, NULL, -1
-    };
-    int flags = CLONE_VFORK | CLONE_VM;
-    if (exec_sibling) {
-        flags |= CLONE_PARENT;
+    future = PyObject_CallMethod(loop, "create_future", NULL);
+    if (!future) {
+        goto end;
     }
-    int childprocess = clone(exec_trampoline, child_stack + sizeof(child_stack), flags, &trampoline_data);
-    if (childprocess < 0) {
-        int code = errno;
-        PyErr_Format(PyExc_Exception, "clone failed with errno=%d", code);
+    state = Py_BuildValue("(OOi)", loop, future, fd);
+    if (!state) {
         goto end;
     }
-
-    pid_t waitpid_result = waitpid(childprocess, NULL, WNOHANG) > 0;
-    if ((trampoline_data.childpid >= 0) && (trampoline_data.childpid != childprocess)) {
-        waitpid_result = waitpid(childprocess, NULL, WNOHANG) > 0;
+    on_readable = PyCFunction_New(&wait_async_on_readable_def, state);
+    on_done = PyCFunction_New(&wait_async_on_done_def, state);
+    if (!on_readable || !on_done) {
+        goto end;
     }
 
-    if (trampoline_data.fun) {
-        PyErr_Format(
-            PyExc_OSError, "clone successful, but %s failed with errno=%d",
-            trampoline_data.fun, trampoline_data.error
-        );
+    outcome = PyObject_CallMethod(loop, "add_reader", "iO", fd, on_readable);
+    if (!outcome) {
         goto end;
     }
-
-    if (waitpid_result == 0) {
-#if PY_MAJOR_VERSION >= 3
-        result = PyLong_FromLong(trampoline_data.childpid);
-#else
-        result = PyInt_FromLong(trampoline_data.childpid);
-#endif
-    } else {
-        Py_INCREF(Py_None);
-        result = Py_None;
+    Py_DECREF(outcome);
+    outcome = PyObject_CallMethod(future, "add_done_callback", "O", on_done);
+    if (!outcome) {
+        Py_XDECREF(wait_async_remove_reader(state));
+        goto end;
     }
 
+    Py_INCREF(future);
+    result = future;
+
   end:
-    pyfree(argv_list);
-    pyfree(envp_list);
-    Py_XDECREF(exec_path);
-    Py_XDECREF(exec_args);
-    Py_XDECREF(exec_env);
+    Py_XDECREF(outcome);
+    Py_XDECREF(on_done);
+    Py_XDECREF(on_readable);
+    Py_XDECREF(state);
+    Py_XDECREF(future);
+    Py_XDECREF(loop);
+    Py_XDECREF(asyncio);
     return result;
 }
+#endif
+
+
+#ifdef HAVE_MODULE_STATE
+static int module_traverse(PyObject *module, visitproc visit, void *arg) {
+    ModuleState *state = module_state(module);
+    Py_VISIT(state->environ_snapshot);
+    Py_VISIT(state->path_cache);
+    Py_VISIT(state->setpdeathsignal_kwnames);
+    Py_VISIT(state->cloneandexecve_kwnames);
+    Py_VISIT(state->spawnspec_type);
+    Py_VISIT(state->supervisor_type);
+    Py_VISIT(state->zygote_type);
+    Py_VISIT(state->pending_spawn_type);
+    return 0;
+}
+
+
+static int module_clear(PyObject *module) {
+    ModuleState *state = module_state(module);
+    Py_CLEAR(state->environ_snapshot);
+    Py_CLEAR(state->path_cache);
+    Py_CLEAR(state->setpdeathsignal_kwnames);
+    Py_CLEAR(state->cloneandexecve_kwnames);
+    Py_CLEAR(state->spawnspec_type);
+    Py_CLEAR(state->supervisor_type);
+    Py_CLEAR(state->zygote_type);
+    Py_CLEAR(state->pending_spawn_type);
+    return 0;
+}
+
+
+static void module_free(void *module) {
+    module_clear((PyObject*) module);
+}
+
+
+// returns a new reference to the type, which was added to the module
+static PyTypeObject *module_add_type(PyObject *module, PyType_Spec *spec) {
+    PyTypeObject *type = (PyTypeObject*) PyType_FromModuleAndSpec(module, spec, NULL);
+    if (!type) {
+        return NULL;
+    }
+    if (PyModule_AddType(module, type) < 0) {
+        Py_DECREF(type);
+        return NULL;
+    }
+    return type;
+}
+#   define MODULE_ADD_TYPE(MODULE, NAME) module_add_type((MODULE), &NAME##_spec)
+#else
+static PyTypeObject *module_add_type(PyObject *module, PyTypeObject *type) {
+    if (PyType_Ready(type) < 0) {
+        return NULL;
+    }
+    Py_INCREF(type);
+    if (PyModule_AddObject(module, strrchr(type->tp_name, '.') + 1, (PyObject*) type) < 0) {
+        Py_DECREF(type);
+        return NULL;
+    }
+    return type;
+}
+#   define MODULE_ADD_TYPE(MODULE, NAME) module_add_type((MODULE), &NAME##_type)
+#endif
+
+
+static int module_exec(PyObject *module) {
+    pthread_once(&child_stack_once, child_stack_init);
+    pthread_once(&setup_once, setup_init);
+
+    ModuleState *state = module_state(module);
+    state->path_cache = PyDict_New();
+    if (!state->path_cache) {
+        return -1;
+    }
+#ifdef HAVE_FASTCALL
+    state->setpdeathsignal_kwnames = keywords_intern(&setpdeathsignal_parser);
+    state->cloneandexecve_kwnames = keywords_intern(&cloneandexecve_parser);
+    if (!state->setpdeathsignal_kwnames || !state->cloneandexecve_kwnames) {
+        return -1;
+    }
+#endif
+    state->spawnspec_type = MODULE_ADD_TYPE(module, spawnspec);
+    state->supervisor_type = MODULE_ADD_TYPE(module, supervisor);
+    state->pending_spawn_type = MODULE_ADD_TYPE(module, pending_spawn);
+    state->zygote_type = MODULE_ADD_TYPE(module, zygote);
+    if (!state->spawnspec_type || !state->supervisor_type || !state->pending_spawn_type || !state->zygote_type) {
+        return -1;
+    }
+#if defined(HAVE_MODULE_STATE) && !defined(Py_TPFLAGS_DISALLOW_INSTANTIATION)
+    // PendingSpawn objects only come from cloneandexecve_nowait()
+    state->pending_spawn_type->tp_new = NULL;
+#endif
+    if (
+        (PyModule_AddIntConstant(module, "MPOL_DEFAULT", MPOL_DEFAULT) < 0) ||
+        (PyModule_AddIntConstant(module, "MPOL_PREFERRED", MPOL_PREFERRED) < 0) ||
+        (PyModule_AddIntConstant(module, "MPOL_BIND", MPOL_BIND) < 0) ||
+        (PyModule_AddIntConstant(module, "MPOL_INTERLEAVE", MPOL_INTERLEAVE) < 0) ||
+        (PyModule_AddIntConstant(module, "MPOL_LOCAL", MPOL_LOCAL) < 0) ||
+        (PyModule_AddIntConstant(module, "IOPRIO_CLASS_RT", IOPRIO_CLASS_RT) < 0) ||
+        (PyModule_AddIntConstant(module, "IOPRIO_CLASS_BE", IOPRIO_CLASS_BE) < 0) ||
+        (PyModule_AddIntConstant(module, "IOPRIO_CLASS_IDLE", IOPRIO_CLASS_IDLE) < 0) ||
+        (PyModule_AddIntConstant(module, "CLONE_NEWNS", CLONE_NEWNS) < 0) ||
+        (PyModule_AddIntConstant(module, "CLONE_NEWUTS", CLONE_NEWUTS) < 0) ||
+        (PyModule_AddIntConstant(module, "CLONE_NEWIPC", CLONE_NEWIPC) < 0) ||
+        (PyModule_AddIntConstant(module, "CLONE_NEWUSER", CLONE_NEWUSER) < 0) ||
+        (PyModule_AddIntConstant(module, "CLONE_NEWPID", CLONE_NEWPID) < 0) ||
+        (PyModule_AddIntConstant(module, "CLONE_NEWNET", CLONE_NEWNET) < 0) ||
+        (PyModule_AddIntConstant(module, "CLONE_NEWCGROUP", CLONE_NEWCGROUP) < 0)
+    ) {
+        return -1;
+    }
+    return 0;
+}
 
 
 PyMODINIT_FUNC
@@ -598,8 +7562,15 @@ initpdeathsignal(void)
 #if PY_VERSION_HEX >= 0x03050000
     return PyModuleDef_Init(&module_def);
 #elif PY_MAJOR_VERSION >= 3
-    return PyModule_Create(&module_def);
+    PyObject *module = PyModule_Create(&module_def);
+    if (module && (module_exec(module) < 0)) {
+        Py_CLEAR(module);
+    }
+    return module;
 #else
-    Py_InitModule3(module_name, functions_def, module_doc);
+    PyObject *module = Py_InitModule3(module_name, functions_def, module_doc);
+    if (module) {
+        module_exec(module);
+    }
 #endif
 }
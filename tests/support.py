@@ -0,0 +1,40 @@
+import os
+import unittest
+
+import pdeathsignal
+
+
+SHELL = b'/bin/sh'
+
+
+def wait(pid):
+    return os.waitpid(pid, 0)[1]
+
+
+def read_all(fd):
+    chunks = []
+    while True:
+        chunk = os.read(fd, 4096)
+        if not chunk:
+            break
+        chunks.append(chunk)
+    os.close(fd)
+    return b''.join(chunks)
+
+
+def run(path, args=None, env=None, **kwargs):
+    read_end, write_end = os.pipe()
+    try:
+        pid = pdeathsignal.cloneandexecve(path, args, env, stdout=write_end, **kwargs)
+    finally:
+        os.close(write_end)
+    output = read_all(read_end)
+    wait(pid)
+    return output
+
+
+class TestCase(unittest.TestCase):
+    def assertNoChildren(self):
+        # failed spawns are reaped already, finished ones by each test
+        with self.assertRaises(ChildProcessError):
+            os.waitpid(-1, os.WNOHANG)
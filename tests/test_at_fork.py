@@ -0,0 +1,49 @@
+import os
+import signal
+import threading
+import unittest
+
+import pdeathsignal
+
+from support import TestCase, wait
+
+
+def fork_and_report():
+    pid = os.fork()
+    if pid == 0:
+        os._exit(pdeathsignal.getpdeathsignal())
+    return os.waitstatus_to_exitcode(wait(pid))
+
+
+class RegisterAtForkTest(TestCase):
+    def tearDown(self):
+        pdeathsignal.register_at_fork(0)
+        self.assertNoChildren()
+
+    def test_signal_is_set_in_the_child(self):
+        self.assertEqual(pdeathsignal.register_at_fork(signal.SIGTERM), 0)
+        self.assertEqual(fork_and_report(), signal.SIGTERM)
+        self.assertEqual(pdeathsignal.register_at_fork(0), signal.SIGTERM)
+        self.assertEqual(fork_and_report(), 0)
+
+    def test_concurrent_changes(self):
+        stop = threading.Event()
+
+        def toggle():
+            while not stop.is_set():
+                pdeathsignal.register_at_fork(signal.SIGUSR1)
+                pdeathsignal.register_at_fork(0)
+
+        thread = threading.Thread(target=toggle)
+        thread.start()
+        try:
+            # every child gets the signal or none, and is never killed by it
+            for _ in range(100):
+                self.assertIn(fork_and_report(), (0, signal.SIGUSR1))
+        finally:
+            stop.set()
+            thread.join()
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,30 @@
+import os
+import unittest
+
+import pdeathsignal
+
+from support import SHELL, TestCase, run, wait
+
+
+class BackendTest(TestCase):
+    def test_clone_is_always_available(self):
+        backends = pdeathsignal.backends()
+        self.assertIn('clone', backends)
+        self.assertLessEqual(set(backends), {'clone', 'clone3', 'posix_spawn'})
+
+    def test_every_backend_spawns(self):
+        for backend in pdeathsignal.backends():
+            with self.subTest(backend=backend):
+                self.assertEqual(run(SHELL, [b'sh', b'-c', b'echo $0'], backend=backend), b'sh\n')
+                status = wait(pdeathsignal.cloneandexecve(SHELL, [b'sh', b'-c', b'exit 9'], backend=backend))
+                self.assertEqual(os.waitstatus_to_exitcode(status), 9)
+        self.assertNoChildren()
+
+    def test_unknown_backend(self):
+        with self.assertRaises(ValueError):
+            pdeathsignal.cloneandexecve(b'/bin/true', backend='vfork')
+        self.assertNoChildren()
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,39 @@
+import os
+import unittest
+
+import pdeathsignal
+
+from support import SHELL, TestCase, run
+
+
+class EnvUpdateTest(TestCase):
+    ARGS = [b'sh', b'-c', b'echo "$PDS_A:$PDS_B"']
+
+    def setUp(self):
+        for name in ('PDS_A', 'PDS_B'):
+            os.environ.pop(name, None)
+        pdeathsignal.refresh_environ()
+
+    def tearDown(self):
+        self.setUp()
+
+    def test_update_and_remove(self):
+        os.environ['PDS_B'] = 'b'
+        pdeathsignal.refresh_environ()
+        self.assertEqual(run(SHELL, self.ARGS, env_update={'PDS_A': 'a'}), b'a:b\n')
+        self.assertEqual(run(SHELL, self.ARGS, env_update={'PDS_A': 'a', 'PDS_B': None}), b'a:\n')
+
+    def test_cached_until_refreshed(self):
+        self.assertEqual(run(SHELL, self.ARGS, env_update={'PDS_A': 'a'}), b'a:\n')
+        os.environ['PDS_B'] = 'b'
+        self.assertEqual(run(SHELL, self.ARGS, env_update={'PDS_A': 'a'}), b'a:\n')
+        generation = pdeathsignal.refresh_environ()
+        self.assertEqual(run(SHELL, self.ARGS, env_update={'PDS_A': 'a'}), b'a:b\n')
+        self.assertGreater(pdeathsignal.refresh_environ(), generation)
+
+    def test_explicit_env(self):
+        self.assertEqual(run(SHELL, self.ARGS, [b'PDS_B=e'], env_update={'PDS_A': 'a'}), b'a:e\n')
+
+
+if __name__ == '__main__':
+    unittest.main()
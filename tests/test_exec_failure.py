@@ -0,0 +1,40 @@
+import errno
+import resource
+import unittest
+
+import pdeathsignal
+
+from support import TestCase
+
+
+class ExecFailureTest(TestCase):
+    def test_failed_exec_raises_and_reaps(self):
+        with self.assertRaises(FileNotFoundError) as raised:
+            pdeathsignal.cloneandexecve(b'/nonexistent/executable')
+        self.assertRegex(str(raised.exception), r'execv\w* failed')
+        self.assertNoChildren()
+
+    def test_failed_exec_reaps_with_every_backend(self):
+        for backend in pdeathsignal.backends():
+            with self.subTest(backend=backend):
+                with self.assertRaises(FileNotFoundError):
+                    pdeathsignal.cloneandexecve(b'/nonexistent/executable', backend=backend)
+                self.assertNoChildren()
+
+    def test_errno_of_the_failed_exec(self):
+        with self.assertRaises(PermissionError) as raised:
+            pdeathsignal.cloneandexecve(b'/')
+        self.assertEqual(raised.exception.errno, errno.EACCES)
+        self.assertNoChildren()
+
+    def test_failed_pre_exec_step(self):
+        # the child fails before the exec, a soft limit above the hard one
+        with self.assertRaises(OSError) as raised:
+            pdeathsignal.cloneandexecve(b'/bin/true', rlimits={resource.RLIMIT_NOFILE: (10, 5)})
+        self.assertEqual(raised.exception.errno, errno.EINVAL)
+        self.assertIn('setrlimit failed', str(raised.exception))
+        self.assertNoChildren()
+
+
+if __name__ == '__main__':
+    unittest.main()
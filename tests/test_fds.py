@@ -0,0 +1,51 @@
+import os
+import unittest
+
+import pdeathsignal
+
+from support import SHELL, TestCase, read_all, run, wait
+
+
+class FileDescriptorTest(TestCase):
+    def test_stdio(self):
+        stdin_read, stdin_write = os.pipe()
+        stdout_read, stdout_write = os.pipe()
+        stderr_read, stderr_write = os.pipe()
+        try:
+            pid = pdeathsignal.cloneandexecve(
+                SHELL, [b'sh', b'-c', b'read line; echo "out $line"; echo "err $line" >&2'],
+                stdin=stdin_read, stdout=stdout_write, stderr=stderr_write,
+            )
+        finally:
+            os.close(stdin_read)
+            os.close(stdout_write)
+            os.close(stderr_write)
+        os.write(stdin_write, b'x\n')
+        os.close(stdin_write)
+        self.assertEqual(read_all(stdout_read), b'out x\n')
+        self.assertEqual(read_all(stderr_read), b'err x\n')
+        self.assertEqual(wait(pid), 0)
+        self.assertNoChildren()
+
+    def test_file_objects(self):
+        stdout_read, stdout_write = os.pipe()
+        with os.fdopen(stdout_write, 'wb') as stdout:
+            pid = pdeathsignal.cloneandexecve(SHELL, [b'sh', b'-c', b'echo file'], stdout=stdout)
+        self.assertEqual(read_all(stdout_read), b'file\n')
+        self.assertEqual(wait(pid), 0)
+
+    def test_close_fds_and_pass_fds(self):
+        kept = os.open(os.devnull, os.O_RDONLY)
+        closed = os.open(os.devnull, os.O_RDONLY)
+        os.set_inheritable(closed, True)
+        try:
+            script = b'test -e /proc/self/fd/%d && echo kept; test -e /proc/self/fd/%d && echo open' % (kept, closed)
+            self.assertEqual(run(SHELL, [b'sh', b'-c', script], close_fds=True, pass_fds=[kept]), b'kept\n')
+            self.assertEqual(run(SHELL, [b'sh', b'-c', script], pass_fds=[kept]), b'kept\nopen\n')
+        finally:
+            os.close(kept)
+            os.close(closed)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,56 @@
+import os
+import threading
+import unittest
+
+import pdeathsignal
+
+from support import SHELL, TestCase, wait
+
+
+class HelperProcessTest(TestCase):
+    def setUp(self):
+        pdeathsignal.use_helper_process()
+
+    def tearDown(self):
+        pdeathsignal.use_helper_process(False)
+        self.assertNoChildren()
+
+    def test_spawn(self):
+        status = wait(pdeathsignal.cloneandexecve(SHELL, [b'sh', b'-c', b'exit 3']))
+        self.assertEqual(os.waitstatus_to_exitcode(status), 3)
+
+    def test_failures_keep_their_step(self):
+        results = pdeathsignal.cloneandexecve_many([b'/nonexistent/executable', b'/'])
+        self.assertIsInstance(results[0], FileNotFoundError)
+        self.assertIsInstance(results[1], PermissionError)
+        for result in results:
+            self.assertIn('execve failed', str(result))
+
+    def test_concurrent_threads(self):
+        errors = []
+
+        def spawn():
+            try:
+                for _ in range(20):
+                    status = wait(pdeathsignal.cloneandexecve(b'/bin/true'))
+                    if status != 0:
+                        errors.append(status)
+            except Exception as error:
+                errors.append(error)
+
+        # the helper is started here, it is tied to the thread that started it
+        wait(pdeathsignal.cloneandexecve(b'/bin/true'))
+        threads = [threading.Thread(target=spawn) for _ in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual(errors, [])
+
+    def test_helper_main_is_guarded(self):
+        with self.assertRaises(RuntimeError):
+            pdeathsignal._helper_main()
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,35 @@
+import os
+import unittest
+
+import pdeathsignal
+
+from support import SHELL, TestCase, wait
+
+
+class ManyTest(TestCase):
+    def test_results_per_spec(self):
+        results = pdeathsignal.cloneandexecve_many([
+            (SHELL, [b'sh', b'-c', b'exit 4']),
+            b'/nonexistent/executable',
+            (SHELL, (b'sh', '-c', 'exit 5')),
+            b'/',
+        ])
+        self.assertIsInstance(results[1], FileNotFoundError)
+        self.assertIsInstance(results[3], PermissionError)
+        self.assertEqual(os.waitstatus_to_exitcode(wait(results[0])), 4)
+        self.assertEqual(os.waitstatus_to_exitcode(wait(results[2])), 5)
+        self.assertNoChildren()
+
+    def test_long_argv(self):
+        args = [b'sh', b'-c', b'exit $#', b'sh'] + [b'x'] * 200
+        status = wait(pdeathsignal.cloneandexecve_many([(SHELL, args)])[0])
+        self.assertEqual(os.waitstatus_to_exitcode(status), 200)
+
+    def test_invalid_args(self):
+        with self.assertRaises(TypeError):
+            pdeathsignal.cloneandexecve_many([(SHELL, [1])])
+        self.assertNoChildren()
+
+
+if __name__ == '__main__':
+    unittest.main()
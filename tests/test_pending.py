@@ -0,0 +1,54 @@
+import os
+import select
+import signal
+import time
+import unittest
+
+import pdeathsignal
+
+from support import SHELL, TestCase, wait
+
+
+class PendingSpawnTest(TestCase):
+    def tearDown(self):
+        pdeathsignal.use_spawner_thread(False)
+
+    def test_result(self):
+        pending = pdeathsignal.cloneandexecve_nowait(SHELL, [b'sh', b'-c', b'exit 6'])
+        deadline = time.monotonic() + 5
+        while not pending.done() and (time.monotonic() < deadline):
+            select.select([pending.fileno()], [], [], 1)
+        self.assertTrue(pending.done())
+        pid = pending.result()
+        self.assertIs(pending.result(), pid)
+        self.assertEqual(os.waitstatus_to_exitcode(wait(pid)), 6)
+        self.assertNoChildren()
+
+    def test_pidfd_is_returned_once(self):
+        pending = pdeathsignal.cloneandexecve_nowait(b'/bin/sleep', [b'sleep', b'10'], pidfd=True)
+        result = pending.result(timeout=5)
+        self.assertIs(pending.result(), result)
+        pid, pidfd = result
+        del pending
+        # the handle did not close the pidfd of the caller
+        signal.pidfd_send_signal(pidfd, signal.SIGKILL)
+        os.close(pidfd)
+        self.assertTrue(os.WIFSIGNALED(wait(pid)))
+
+    def test_failure_is_raised_every_time(self):
+        pending = pdeathsignal.cloneandexecve_nowait(b'/nonexistent/executable')
+        for attempt in range(2):
+            with self.assertRaises(FileNotFoundError):
+                pending.result(timeout=5)
+        self.assertNoChildren()
+
+    def test_arguments_are_copied(self):
+        args = [b'sh', b'-c', b'exit 7']
+        pending = pdeathsignal.cloneandexecve_nowait(SHELL, args)
+        args[2] = b'exit 0'
+        pid = pending.result(timeout=5)
+        self.assertEqual(os.waitstatus_to_exitcode(wait(pid)), 7)
+
+
+if __name__ == '__main__':
+    unittest.main()
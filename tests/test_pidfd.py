@@ -0,0 +1,35 @@
+import os
+import select
+import signal
+import unittest
+
+import pdeathsignal
+
+from support import SHELL, TestCase
+
+
+class PidfdTest(TestCase):
+    def test_pidfd_of_every_backend(self):
+        for backend in pdeathsignal.backends():
+            with self.subTest(backend=backend):
+                pid, pidfd = pdeathsignal.cloneandexecve(
+                    SHELL, [b'sh', b'-c', b'exit 4'], backend=backend, pidfd=True
+                )
+                try:
+                    self.assertEqual(select.select([pidfd], [], [], 5)[0], [pidfd])
+                    self.assertEqual(os.waitstatus_to_exitcode(os.waitpid(pid, 0)[1]), 4)
+                finally:
+                    os.close(pidfd)
+        self.assertNoChildren()
+
+    def test_pidfd_signals_the_child(self):
+        pid, pidfd = pdeathsignal.cloneandexecve(b'/bin/sleep', [b'sleep', b'10'], pidfd=True)
+        try:
+            signal.pidfd_send_signal(pidfd, signal.SIGKILL)
+        finally:
+            os.close(pidfd)
+        self.assertEqual(os.WTERMSIG(os.waitpid(pid, 0)[1]), signal.SIGKILL)
+
+
+if __name__ == '__main__':
+    unittest.main()
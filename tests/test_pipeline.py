@@ -0,0 +1,42 @@
+import os
+import unittest
+
+import pdeathsignal
+
+from support import TestCase, read_all, wait
+
+
+class PipelineTest(TestCase):
+    def test_wiring(self):
+        stdin_read, stdin_write = os.pipe()
+        stdout_read, stdout_write = os.pipe()
+        try:
+            pids = pdeathsignal.spawn_pipeline(
+                [b'/bin/cat', (b'/usr/bin/tr', [b'tr', b'a-z', b'A-Z']), b'/bin/cat'],
+                stdin=stdin_read, stdout=stdout_write,
+            )
+        finally:
+            os.close(stdin_read)
+            os.close(stdout_write)
+        self.assertEqual(len(pids), 3)
+        # one group, led by the first child
+        self.assertEqual([os.getpgid(pid) for pid in pids], [pids[0]] * 3)
+        os.write(stdin_write, b'through the pipeline\n')
+        os.close(stdin_write)
+        self.assertEqual(read_all(stdout_read), b'THROUGH THE PIPELINE\n')
+        self.assertEqual([wait(pid) for pid in pids], [0, 0, 0])
+        self.assertNoChildren()
+
+    def test_failure_kills_the_group(self):
+        stdin_read, stdin_write = os.pipe()
+        try:
+            with self.assertRaises(FileNotFoundError):
+                pdeathsignal.spawn_pipeline([b'/bin/cat', b'/nonexistent/executable'], stdin=stdin_read)
+        finally:
+            os.close(stdin_read)
+            os.close(stdin_write)
+        self.assertNoChildren()
+
+
+if __name__ == '__main__':
+    unittest.main()
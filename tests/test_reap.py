@@ -0,0 +1,79 @@
+import os
+import signal
+import unittest
+
+import pdeathsignal
+
+from support import TestCase
+
+
+SLEEP = (b'/bin/sleep', [b'sleep', b'10'])
+
+
+class ReapTest(TestCase):
+    KEYS = {
+        'pid', 'status', 'utime', 'stime', 'maxrss', 'minflt', 'majflt',
+        'inblock', 'oublock', 'nvcsw', 'nivcsw', 'duration',
+    }
+
+    def test_pidfd(self):
+        pid, pidfd = pdeathsignal.cloneandexecve(
+            b'/bin/sh', [b'sh', b'-c', b'sleep 0.1; exit 3'], pidfd=True
+        )
+        try:
+            records = pdeathsignal.reap([(pid, pidfd)])
+        finally:
+            os.close(pidfd)
+        self.assertEqual(len(records), 1)
+        record = records[0]
+        self.assertEqual(set(record), self.KEYS)
+        self.assertEqual(record['pid'], pid)
+        self.assertEqual(os.waitstatus_to_exitcode(record['status']), 3)
+        self.assertGreater(record['maxrss'], 0)
+        self.assertGreaterEqual(record['duration'], 0.1)
+        self.assertLess(record['duration'], 10)
+        self.assertNoChildren()
+
+    def test_pids_in_the_order_given(self):
+        slow = pdeathsignal.cloneandexecve(b'/bin/sleep', [b'sleep', b'0.2'])
+        fast = pdeathsignal.cloneandexecve(b'/bin/sleep', [b'sleep', b'0.05'])
+        records = pdeathsignal.reap([slow, fast])
+        self.assertEqual([record['pid'] for record in records], [slow, fast])
+        self.assertLess(records[1]['duration'], records[0]['duration'])
+        self.assertNoChildren()
+
+    def test_timeout(self):
+        pid = pdeathsignal.cloneandexecve(*SLEEP)
+        try:
+            self.assertEqual(pdeathsignal.reap([pid], timeout=0), [])
+            self.assertEqual(pdeathsignal.reap([pid], timeout=0.05), [])
+        finally:
+            os.kill(pid, signal.SIGKILL)
+        records = pdeathsignal.reap([pid])
+        self.assertEqual(os.WTERMSIG(records[0]['status']), signal.SIGKILL)
+
+    def test_not_recorded(self):
+        pid = os.fork()
+        if pid == 0:
+            os._exit(0)
+        records = pdeathsignal.reap([pid])
+        self.assertEqual(records[0]['pid'], pid)
+        self.assertIsNone(records[0]['duration'])
+
+    def test_every_quick_exit_is_recorded(self):
+        # none of them is reaped at spawn, however quickly it exits
+        pids = [pdeathsignal.cloneandexecve(b'/bin/true') for _ in range(200)]
+        records = pdeathsignal.reap(pids)
+        self.assertEqual([record['pid'] for record in records], pids)
+        for record in records:
+            self.assertEqual(os.waitstatus_to_exitcode(record['status']), 0)
+            self.assertIsNotNone(record['duration'])
+        self.assertNoChildren()
+
+    def test_not_a_child(self):
+        self.assertEqual(pdeathsignal.reap([os.getpid()], timeout=0), [])
+
+
+
+if __name__ == '__main__':
+    unittest.main()
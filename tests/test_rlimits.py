@@ -0,0 +1,18 @@
+import resource
+import unittest
+
+from support import SHELL, TestCase, run
+
+
+class ResourceLimitsTest(TestCase):
+    def test_rlimits(self):
+        output = run(SHELL, [b'sh', b'-c', b'ulimit -n'], rlimits={resource.RLIMIT_NOFILE: 64})
+        self.assertEqual(output, b'64\n')
+
+    def test_oom_score_adj(self):
+        output = run(SHELL, [b'sh', b'-c', b'cat /proc/self/oom_score_adj'], oom_score_adj=500)
+        self.assertEqual(output, b'500\n')
+
+
+if __name__ == '__main__':
+    unittest.main()
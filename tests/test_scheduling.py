@@ -0,0 +1,20 @@
+import os
+import unittest
+
+from support import SHELL, TestCase, run
+
+
+class SchedulingTest(TestCase):
+    def test_cpu_affinity(self):
+        cpu = min(os.sched_getaffinity(0))
+        output = run(SHELL, [b'sh', b'-c', b'grep Cpus_allowed_list /proc/self/status'], cpu_affinity=[cpu])
+        self.assertEqual(output.split()[1], str(cpu).encode())
+
+    def test_nice(self):
+        nice = min(os.getpriority(os.PRIO_PROCESS, 0) + 5, 19)
+        output = run(SHELL, [b'sh', b'-c', b'cut -d" " -f19 /proc/self/stat'], nice=nice)
+        self.assertEqual(int(output), nice)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,57 @@
+import os
+import shutil
+import tempfile
+import unittest
+
+import pdeathsignal
+
+from support import TestCase, run
+
+
+class SearchPathTest(TestCase):
+    def setUp(self):
+        self.directories = [tempfile.mkdtemp(), tempfile.mkdtemp()]
+        self.path = os.environ['PATH']
+        os.environ['PATH'] = os.pathsep.join(self.directories + [self.path])
+        pdeathsignal.clear_path_cache()
+
+    def tearDown(self):
+        os.environ['PATH'] = self.path
+        pdeathsignal.clear_path_cache()
+        for directory in self.directories:
+            shutil.rmtree(directory)
+
+    def install(self, index, text):
+        path = os.path.join(self.directories[index], 'pds-tool')
+        with open(path, 'w') as script:
+            script.write('#!/bin/sh\necho %s\n' % text)
+        os.chmod(path, 0o755)
+        return path
+
+    def test_resolves_in_path(self):
+        self.install(1, 'second')
+        self.assertEqual(run(b'pds-tool', search_path=True), b'second\n')
+        self.assertEqual(run(b'pds-tool', search_path=True), b'second\n')
+
+    def test_cache_is_revalidated(self):
+        self.install(1, 'second')
+        self.assertEqual(run(b'pds-tool', search_path=True), b'second\n')
+        # an earlier directory in $PATH changed
+        first = self.install(0, 'first')
+        self.assertEqual(run(b'pds-tool', search_path=True), b'first\n')
+        os.unlink(first)
+        os.unlink(os.path.join(self.directories[1], 'pds-tool'))
+        with self.assertRaises(FileNotFoundError):
+            run(b'pds-tool', search_path=True)
+        self.assertNoChildren()
+
+    def test_follows_path_changes(self):
+        self.install(1, 'second')
+        self.assertEqual(run(b'pds-tool', search_path=True), b'second\n')
+        os.environ['PATH'] = self.path
+        with self.assertRaises(FileNotFoundError):
+            run(b'pds-tool', search_path=True)
+
+
+if __name__ == '__main__':
+    unittest.main()
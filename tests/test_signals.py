@@ -0,0 +1,36 @@
+import signal
+import unittest
+
+from support import TestCase, run
+
+
+def mask_of(field, **kwargs):
+    # grep itself, a shell would reset the mask
+    output = run(b'/bin/grep', [b'grep', field, b'/proc/self/status'], **kwargs)
+    return int(output.split()[1], 16)
+
+
+class SignalsTest(TestCase):
+    def test_sigign_list_and_bitmask(self):
+        ignored = mask_of(b'SigIgn', sigign=[signal.SIGUSR1, signal.SIGUSR2])
+        self.assertTrue(ignored & (1 << (signal.SIGUSR1 - 1)))
+        self.assertTrue(ignored & (1 << (signal.SIGUSR2 - 1)))
+        ignored = mask_of(b'SigIgn', sigign=1 << (signal.SIGHUP - 1))
+        self.assertTrue(ignored & (1 << (signal.SIGHUP - 1)))
+
+    def test_realtime_signals(self):
+        ignored = mask_of(b'SigIgn', sigign=[signal.SIGRTMAX])
+        self.assertTrue(ignored & (1 << (signal.SIGRTMAX - 1)))
+
+    def test_sigmask(self):
+        blocked = mask_of(b'SigBlk', sigmask=[signal.SIGUSR1])
+        self.assertTrue(blocked & (1 << (signal.SIGUSR1 - 1)))
+
+    def test_out_of_range(self):
+        with self.assertRaises(ValueError):
+            run(b'/bin/true', sigign=[signal.NSIG])
+        self.assertNoChildren()
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,60 @@
+import os
+import select
+import signal
+import time
+import unittest
+
+import pdeathsignal
+
+from support import SHELL, TestCase, wait
+
+
+class CloneAndExecveTest(TestCase):
+    def test_exit_status(self):
+        status = wait(pdeathsignal.cloneandexecve(SHELL, [b'sh', b'-c', b'exit 3']))
+        self.assertEqual(os.waitstatus_to_exitcode(status), 3)
+
+    def test_quick_exit_is_left_to_the_caller(self):
+        for backend in pdeathsignal.backends():
+            with self.subTest(backend=backend):
+                for _ in range(20):
+                    pid = pdeathsignal.cloneandexecve(b'/bin/true', backend=backend)
+                    self.assertIsInstance(pid, int)
+                    self.assertEqual(os.waitstatus_to_exitcode(wait(pid)), 0)
+                self.assertNoChildren()
+
+    def test_doublefork_returns_the_grandchild(self):
+        pid = pdeathsignal.cloneandexecve(b'/bin/sleep', [b'sleep', b'10'], doublefork=True)
+        try:
+            # the pid is known before the grandchild has executed sleep
+            deadline = time.monotonic() + 5
+            while time.monotonic() < deadline:
+                with open('/proc/%d/cmdline' % pid, 'rb') as cmdline:
+                    arg0 = cmdline.read().split(b'\0')[0]
+                if arg0 == b'sleep':
+                    break
+                time.sleep(0.01)
+            self.assertEqual(arg0, b'sleep')
+            with open('/proc/%d/status' % pid) as status:
+                fields = dict(line.split(':\t', 1) for line in status)
+            self.assertNotEqual(int(fields['PPid']), os.getpid())
+            # the middle child is reaped, the grandchild is not ours
+            self.assertNoChildren()
+        finally:
+            os.kill(pid, signal.SIGKILL)
+
+    def test_doublefork_pidfd(self):
+        pid, pidfd = pdeathsignal.cloneandexecve(
+            b'/bin/sleep', [b'sleep', b'10'], doublefork=True, pidfd=True
+        )
+        try:
+            signal.pidfd_send_signal(pidfd, signal.SIGKILL)
+            # the pidfd becomes readable when the grandchild exits
+            self.assertEqual(select.select([pidfd], [], [], 5)[0], [pidfd])
+        finally:
+            os.close(pidfd)
+        self.assertNoChildren()
+
+
+if __name__ == '__main__':
+    unittest.main()
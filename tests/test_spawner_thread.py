@@ -0,0 +1,53 @@
+import os
+import signal
+import threading
+import time
+import unittest
+
+import pdeathsignal
+
+from support import TestCase, wait
+
+
+def spawn_in_a_thread():
+    result = []
+    thread = threading.Thread(
+        target=lambda: result.append(
+            pdeathsignal.cloneandexecve(b'/bin/sleep', [b'sleep', b'10'], signal=signal.SIGKILL)
+        )
+    )
+    thread.start()
+    thread.join()
+    return result[0]
+
+
+def alive_after(pid, seconds):
+    # a zombie already got its death signal
+    time.sleep(seconds)
+    with open('/proc/%d/stat' % pid) as stat:
+        return stat.read().rsplit(')', 1)[1].split()[0] != 'Z'
+
+
+class SpawnerThreadTest(TestCase):
+    def tearDown(self):
+        pdeathsignal.use_spawner_thread(False)
+        self.assertNoChildren()
+
+    def test_death_signal_follows_the_spawning_thread(self):
+        pdeathsignal.use_spawner_thread(False)
+        pid = spawn_in_a_thread()
+        self.assertFalse(alive_after(pid, 0.2))
+        self.assertEqual(os.WTERMSIG(wait(pid)), signal.SIGKILL)
+
+    def test_death_signal_follows_the_process(self):
+        self.assertFalse(pdeathsignal.use_spawner_thread(True))
+        pid = spawn_in_a_thread()
+        try:
+            self.assertTrue(alive_after(pid, 0.2))
+        finally:
+            os.kill(pid, signal.SIGTERM)
+        self.assertEqual(os.WTERMSIG(wait(pid)), signal.SIGTERM)
+
+
+if __name__ == '__main__':
+    unittest.main()
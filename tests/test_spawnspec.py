@@ -0,0 +1,46 @@
+import os
+import unittest
+
+import pdeathsignal
+
+from support import TestCase, wait
+
+
+class SpawnSpecTest(TestCase):
+    def test_spawn_again(self):
+        spec = pdeathsignal.SpawnSpec(b'/bin/sh', [b'sh', b'-c', b'sleep 0.05; exit $#', b'sh'])
+        for _ in range(3):
+            self.assertEqual(os.waitstatus_to_exitcode(wait(spec.spawn())), 0)
+        self.assertNoChildren()
+
+    def test_extra_args(self):
+        spec = pdeathsignal.SpawnSpec(b'/bin/sh', [b'sh', b'-c', b'sleep 0.05; exit $#', b'sh'])
+        self.assertEqual(os.waitstatus_to_exitcode(wait(spec.spawn([b'a', 'b']))), 2)
+        self.assertEqual(os.waitstatus_to_exitcode(wait(spec.spawn())), 0)
+
+    def test_arguments_are_copied(self):
+        args = [b'sh', b'-c', b'sleep 0.05; exit 4']
+        spec = pdeathsignal.SpawnSpec(b'/bin/sh', args)
+        args[2] = b'exit 0'
+        self.assertEqual(os.waitstatus_to_exitcode(wait(spec.spawn())), 4)
+
+    def test_failure(self):
+        spec = pdeathsignal.SpawnSpec(b'/nonexistent/executable')
+        with self.assertRaises(FileNotFoundError):
+            spec.spawn()
+        self.assertNoChildren()
+
+    def test_initialized_once(self):
+        spec = pdeathsignal.SpawnSpec(b'/bin/sh', [b'sh', b'-c', b'sleep 0.05; exit 5'])
+        with self.assertRaises(ValueError):
+            spec.__init__(b'/bin/false')
+        self.assertEqual(os.waitstatus_to_exitcode(wait(spec.spawn())), 5)
+
+    def test_not_initialized(self):
+        spec = pdeathsignal.SpawnSpec.__new__(pdeathsignal.SpawnSpec)
+        with self.assertRaises(ValueError):
+            spec.spawn()
+
+
+if __name__ == '__main__':
+    unittest.main()
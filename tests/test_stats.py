@@ -0,0 +1,45 @@
+import unittest
+
+import pdeathsignal
+
+from support import TestCase, wait
+
+
+class SpawnStatsTest(TestCase):
+    def setUp(self):
+        self.previous = pdeathsignal.set_spawn_stats(True)
+        pdeathsignal.get_spawn_stats(reset=True)
+
+    def tearDown(self):
+        pdeathsignal.set_spawn_stats(self.previous)
+
+    def test_counts_spawns_and_failures(self):
+        for _ in range(3):
+            wait(pdeathsignal.cloneandexecve(b'/bin/true'))
+        with self.assertRaises(FileNotFoundError):
+            pdeathsignal.cloneandexecve(b'/nonexistent/executable')
+        stats = pdeathsignal.get_spawn_stats()
+        self.assertEqual(stats['spawns'], 4)
+        self.assertEqual(stats['failures'], 1)
+        self.assertEqual(sum(stats['failures_by_fun'].values()), 1)
+        spawn = stats['phases']['spawn']
+        self.assertEqual(spawn['count'], 4)
+        self.assertGreater(spawn['total_ns'], 0)
+        self.assertLessEqual(spawn['max_ns'], spawn['total_ns'])
+        self.assertLessEqual(spawn['p50_ns'], spawn['p99_ns'])
+        self.assertEqual(sum(spawn['histogram']), 4)
+        self.assertNoChildren()
+
+    def test_reset(self):
+        wait(pdeathsignal.cloneandexecve(b'/bin/true'))
+        self.assertEqual(pdeathsignal.get_spawn_stats(reset=True)['spawns'], 1)
+        self.assertEqual(pdeathsignal.get_spawn_stats()['spawns'], 0)
+
+    def test_disabled(self):
+        pdeathsignal.set_spawn_stats(False)
+        wait(pdeathsignal.cloneandexecve(b'/bin/true'))
+        self.assertEqual(pdeathsignal.get_spawn_stats()['spawns'], 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
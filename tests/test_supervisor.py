@@ -0,0 +1,75 @@
+import os
+import signal
+import time
+import unittest
+
+import pdeathsignal
+
+from support import TestCase, wait
+
+
+SLEEP = (b'/bin/sleep', [b'sleep', b'10'])
+
+
+class SupervisorTest(TestCase):
+    def setUp(self):
+        # a subreaper would be process-wide, it is not undone
+        self.supervisor = pdeathsignal.Supervisor(subreaper=False)
+
+    def tearDown(self):
+        self.supervisor.terminate_all(signal.SIGKILL, grace=5)
+        self.assertNoChildren()
+
+    def test_one_group(self):
+        self.assertIsNone(self.supervisor.pgid)
+        first = self.supervisor.spawn(*SLEEP)
+        second = self.supervisor.spawn(*SLEEP)
+        self.assertEqual(self.supervisor.pgid, first)
+        self.assertEqual(os.getpgid(first), first)
+        self.assertEqual(os.getpgid(second), first)
+
+    def test_reap_all(self):
+        pid = self.supervisor.spawn(b'/bin/sh', [b'sh', b'-c', b'exit 2'])
+        self.assertEqual(
+            [(pid, os.waitstatus_to_exitcode(status)) for pid, status in self.supervisor.reap_all(block=True)],
+            [(pid, 2)],
+        )
+        self.assertEqual(self.supervisor.reap_all(), [])
+
+    def test_terminate_all(self):
+        pids = {self.supervisor.spawn(*SLEEP) for _ in range(3)}
+        started = time.monotonic()
+        reaped = self.supervisor.terminate_all(grace=5)
+        # woken by the exits, not by the end of grace
+        self.assertLess(time.monotonic() - started, 1)
+        self.assertEqual({pid for pid, status in reaped}, pids)
+        for pid, status in reaped:
+            self.assertTrue(os.WIFSIGNALED(status))
+            self.assertEqual(os.WTERMSIG(status), signal.SIGTERM)
+        self.assertEqual(self.supervisor.reap_all(), [])
+
+    def test_terminate_all_kills_after_grace(self):
+        pid = self.supervisor.spawn(
+            b'/bin/sh', [b'sh', b'-c', b'sleep 10'], sigign=[signal.SIGTERM]
+        )
+        started = time.monotonic()
+        reaped = self.supervisor.terminate_all(grace=0.2)
+        self.assertGreaterEqual(time.monotonic() - started, 0.2)
+        self.assertEqual(len(reaped), 1)
+        self.assertEqual(reaped[0][0], pid)
+        self.assertEqual(os.WTERMSIG(reaped[0][1]), signal.SIGKILL)
+
+    def test_terminate_all_without_grace(self):
+        pid = self.supervisor.spawn(*SLEEP)
+        self.supervisor.terminate_all()
+        # only the children that had exited already were reaped
+        self.assertEqual(os.WTERMSIG(wait(pid)), signal.SIGTERM)
+        self.assertEqual(self.supervisor.reap_all(), [])
+
+    def test_sibling_is_rejected(self):
+        with self.assertRaises(ValueError):
+            self.supervisor.spawn(*SLEEP, sibling=True)
+
+
+if __name__ == '__main__':
+    unittest.main()
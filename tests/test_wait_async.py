@@ -0,0 +1,39 @@
+import asyncio
+import os
+import unittest
+
+import pdeathsignal
+
+from support import SHELL, TestCase
+
+
+class WaitAsyncTest(TestCase):
+    def test_resolves_to_the_status(self):
+        async def main():
+            pid, pidfd = pdeathsignal.cloneandexecve(SHELL, [b'sh', b'-c', b'exit 5'], pidfd=True)
+            try:
+                return await asyncio.wait_for(pdeathsignal.wait_async(pidfd), 5)
+            finally:
+                os.close(pidfd)
+
+        self.assertEqual(os.waitstatus_to_exitcode(asyncio.run(main())), 5)
+        self.assertNoChildren()
+
+    def test_many_children(self):
+        async def main():
+            children = [
+                pdeathsignal.cloneandexecve(SHELL, [b'sh', b'-c', b'exit %d' % code], pidfd=True)
+                for code in range(5)
+            ]
+            try:
+                return await asyncio.gather(*(pdeathsignal.wait_async(pidfd) for pid, pidfd in children))
+            finally:
+                for pid, pidfd in children:
+                    os.close(pidfd)
+
+        self.assertEqual([os.waitstatus_to_exitcode(status) for status in asyncio.run(main())], list(range(5)))
+        self.assertNoChildren()
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,80 @@
+import os
+import signal
+import sys
+import threading
+import unittest
+
+import pdeathsignal
+
+from support import TestCase
+
+
+def zygote_target(payload):
+    if payload == b'raise':
+        # the worker prints the traceback before it exits with 1
+        sys.stderr = open(os.devnull, 'w')
+        raise RuntimeError('in the worker')
+    elif payload.startswith(b'exit'):
+        return int(payload[4:])
+    elif payload == b'sleep':
+        signal.pause()
+
+
+class ZygoteTest(TestCase):
+    def setUp(self):
+        self.zygote = pdeathsignal.Zygote(zygote_target)
+
+    def tearDown(self):
+        self.zygote.close()
+        self.assertIsNone(self.zygote.pid)
+        self.assertNoChildren()
+
+    def test_exit_status_with_pidfd(self):
+        workers = {}
+        for code in (3, 0, 5):
+            pid, pidfd = self.zygote.spawn(b'exit%d' % code, pidfd=True)
+            workers[pid] = (pidfd, code)
+        for _ in workers:
+            pid, status = self.zygote.wait(timeout=5)
+            pidfd, code = workers[pid]
+            self.assertEqual(os.waitstatus_to_exitcode(status), code)
+            os.close(pidfd)
+        self.assertIsNone(self.zygote.wait(timeout=0))
+
+    def test_exception_and_signal(self):
+        pid, pidfd = self.zygote.spawn(b'raise', pidfd=True)
+        self.assertEqual(self.zygote.wait(timeout=5), (pid, 1 << 8))
+        os.close(pidfd)
+        pid, pidfd = self.zygote.spawn(b'sleep', pidfd=True)
+        signal.pidfd_send_signal(pidfd, signal.SIGKILL)
+        found, status = self.zygote.wait(timeout=5)
+        os.close(pidfd)
+        self.assertEqual(found, pid)
+        self.assertEqual(os.WTERMSIG(status), signal.SIGKILL)
+
+    def test_only_pidfd_workers_are_reported(self):
+        self.zygote.spawn(b'exit0')
+        self.assertIsNone(self.zygote.wait(timeout=0.2))
+
+    def test_close_wakes_up_wait(self):
+        errors = []
+
+        def waiter():
+            try:
+                self.zygote.wait()
+            except OSError as error:
+                errors.append(error)
+
+        thread = threading.Thread(target=waiter)
+        thread.start()
+        thread.join(0.1)
+        self.zygote.close()
+        thread.join(5)
+        self.assertFalse(thread.is_alive())
+        self.assertEqual(len(errors), 1)
+        with self.assertRaises(OSError):
+            self.zygote.wait(timeout=0)
+
+
+if __name__ == '__main__':
+    unittest.main()